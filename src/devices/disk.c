@@ -7,6 +7,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -32,6 +33,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -47,6 +49,17 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+
+/* Most sectors one command may transfer.  The Sector Count
+   register is 8 bits wide, with 0 meaning 256. */
+#define MAX_SECTORS_PER_COMMAND 256
+
+/* A queued request older than this many timer ticks is served
+   next, whatever the elevator order, so none starves. */
+#define DISK_DEADLINE_TICKS 20
 
 /* An ATA device. */
 struct disk 
@@ -57,6 +70,8 @@ struct disk
 
     bool is_ata;                /* 1=This device is an ATA disk. */
     disk_sector_t capacity;     /* Capacity in sectors (if is_ata). */
+    int multiple;               /* Sectors per interrupt with READ/WRITE
+                                   MULTIPLE, 0 if not supported. */
 
     long long read_cnt;         /* Number of sectors read. */
     long long write_cnt;        /* Number of sectors written. */
@@ -75,6 +90,13 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    struct lock queue_lock;     /* Protects queue and head. */
+    struct condition queue_ready;       /* Signaled when queue gains a
+                                           request. */
+    struct list queue;          /* Pending disk_requests, oldest first. */
+    uint64_t head;              /* Elevator position: request_key() of
+                                   the sector after the last transfer. */
+
     struct disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,8 +107,9 @@ static struct channel channels[CHANNEL_CNT];
 static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
+static void set_multiple_mode (struct disk *, int);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -98,6 +121,11 @@ static void select_device_wait (const struct disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+static thread_func disk_worker NO_RETURN;
+static struct disk_request *pick_request (struct channel *);
+static void transfer (struct disk *, struct list *batch, size_t cnt,
+                      bool write);
+
 /* Initialize the disk subsystem and detect disks. */
 void
 disk_init (void) 
@@ -127,6 +155,10 @@ disk_init (void)
       lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      lock_init (&c->queue_lock);
+      cond_init (&c->queue_ready);
+      list_init (&c->queue);
+      c->head = 0;
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -138,6 +170,7 @@ disk_init (void)
 
           d->is_ata = false;
           d->capacity = 0;
+          d->multiple = 0;
 
           d->read_cnt = d->write_cnt = 0;
         }
@@ -156,6 +189,9 @@ disk_init (void)
       for (dev_no = 0; dev_no < 2; dev_no++)
         if (c->devices[dev_no].is_ata)
           identify_ata_device (&c->devices[dev_no]);
+
+      /* From now on all transfers go through the queue. */
+      thread_create (c->name, PRI_DEFAULT, disk_worker, c);
     }
 }
 
@@ -219,21 +255,7 @@ disk_size (struct disk *d)
 void
 disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) 
 {
-  struct channel *c;
-  
-  ASSERT (d != NULL);
-  ASSERT (buffer != NULL);
-
-  c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  d->read_cnt++;
-  lock_release (&c->lock);
+  disk_read_multi (d, sec_no, buffer, 1);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -244,23 +266,285 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer)
 void
 disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer)
 {
-  struct channel *c;
-  
+  disk_write_multi (d, sec_no, buffer, 1);
+}
+
+/* Reads CNT consecutive sectors starting at SEC_NO from disk D
+   into BUFFER, which must have room for CNT * DISK_SECTOR_SIZE
+   bytes, and waits for the transfer to complete.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_read_multi (struct disk *d, disk_sector_t sec_no, void *buffer,
+                 size_t cnt) 
+{
+  struct disk_request r;
+
+  disk_request_init (&r, d, sec_no, buffer, cnt, false);
+  disk_submit (&r);
+  disk_wait (&r);
+}
+
+/* Writes CNT consecutive sectors starting at SEC_NO to disk D
+   from BUFFER, which must contain CNT * DISK_SECTOR_SIZE bytes.
+   Returns after the disk has acknowledged receiving the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+void
+disk_write_multi (struct disk *d, disk_sector_t sec_no, const void *buffer,
+                  size_t cnt)
+{
+  struct disk_request r;
+
+  disk_request_init (&r, d, sec_no, (void *) buffer, cnt, true);
+  disk_submit (&r);
+  disk_wait (&r);
+}
+
+/* Initializes R to transfer CNT sectors starting at SEC_NO
+   between disk D and BUFFER, to the disk if WRITE. */
+void
+disk_request_init (struct disk_request *r, struct disk *d,
+                   disk_sector_t sec_no, void *buffer, size_t cnt,
+                   bool write)
+{
   ASSERT (d != NULL);
   ASSERT (buffer != NULL);
+  ASSERT (cnt > 0);
+  ASSERT (sec_no < d->capacity && cnt <= d->capacity - sec_no);
+
+  r->disk = d;
+  r->sec_no = sec_no;
+  r->cnt = cnt;
+  r->buffer = buffer;
+  r->write = write;
+  sema_init (&r->done, 0);
+}
+
+/* Queues R on its disk's channel and returns without waiting.
+   R and its buffer must stay put until R is done.  Requests on
+   one channel are served in elevator order, but never ahead of
+   an older request for an overlapping sector if either one
+   writes. */
+void
+disk_submit (struct disk_request *r)
+{
+  struct channel *c = r->disk->channel;
+
+  r->submitted = timer_ticks ();
+  lock_acquire (&c->queue_lock);
+  list_push_back (&c->queue, &r->elem);
+  cond_signal (&c->queue_ready, &c->queue_lock);
+  lock_release (&c->queue_lock);
+}
+
+/* Waits for submitted request R to complete. */
+void
+disk_wait (struct disk_request *r)
+{
+  sema_down (&r->done);
+}
+
+/* Elevator sort key of sector SEC_NO on disk D. */
+static uint64_t
+request_key (const struct disk *d, disk_sector_t sec_no)
+{
+  return ((uint64_t) d->dev_no << 32) | sec_no;
+}
+
+/* Returns true if A and B touch a common sector and at least
+   one of them writes, so they must be done in order. */
+static bool
+requests_conflict (const struct disk_request *a,
+                   const struct disk_request *b)
+{
+  return (a->disk == b->disk
+          && (a->write || b->write)
+          && a->sec_no < b->sec_no + b->cnt
+          && b->sec_no < a->sec_no + a->cnt);
+}
+
+/* Returns true if queued request R may be served now, that is,
+   if no request queued before it conflicts with it. */
+static bool
+request_ready (struct channel *c, const struct disk_request *r)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&c->queue); e != &r->elem; e = list_next (e))
+    if (requests_conflict (list_entry (e, struct disk_request, elem), r))
+      return false;
+  return true;
+}
+
+/* Removes and returns the next request to serve from C's queue,
+   which must not be empty: the oldest one if it is past its
+   deadline, otherwise the first one at or past the elevator
+   head, wrapping around to the lowest sector (C-SCAN).
+   C's queue_lock must be held. */
+static struct disk_request *
+pick_request (struct channel *c)
+{
+  struct disk_request *oldest, *next = NULL, *lowest = NULL;
+  struct list_elem *e;
+
+  ASSERT (!list_empty (&c->queue));
+
+  oldest = list_entry (list_front (&c->queue), struct disk_request, elem);
+  if (timer_elapsed (oldest->submitted) >= DISK_DEADLINE_TICKS)
+    next = oldest;
+  else
+    for (e = list_begin (&c->queue); e != list_end (&c->queue);
+         e = list_next (e))
+      {
+        struct disk_request *r = list_entry (e, struct disk_request, elem);
+        uint64_t key = request_key (r->disk, r->sec_no);
+
+        if (!request_ready (c, r))
+          continue;
+        if (key >= c->head
+            && (next == NULL || key < request_key (next->disk, next->sec_no)))
+          next = r;
+        if (lowest == NULL || key < request_key (lowest->disk, lowest->sec_no))
+          lowest = r;
+      }
+
+  /* The oldest request is always ready. */
+  if (next == NULL)
+    next = lowest != NULL ? lowest : oldest;
+  list_remove (&next->elem);
+  return next;
+}
+
+/* Serves the requests queued on channel C, merging requests for
+   consecutive sectors in the same direction into one transfer. */
+static void
+disk_worker (void *c_)
+{
+  struct channel *c = c_;
+
+  for (;;)
+    {
+      struct list batch;
+      struct disk_request *first, *last;
+      size_t cnt;
+      bool merged;
+
+      lock_acquire (&c->queue_lock);
+      while (list_empty (&c->queue))
+        cond_wait (&c->queue_ready, &c->queue_lock);
+
+      first = last = pick_request (c);
+      cnt = first->cnt;
+      list_init (&batch);
+      list_push_back (&batch, &first->elem);
+      do 
+        {
+          struct list_elem *e;
+
+          merged = false;
+          for (e = list_begin (&c->queue); e != list_end (&c->queue);
+               e = list_next (e))
+            {
+              struct disk_request *r = list_entry (e, struct disk_request,
+                                                   elem);
+              if (r->disk == last->disk && r->write == last->write
+                  && r->sec_no == last->sec_no + last->cnt
+                  && cnt + r->cnt <= MAX_SECTORS_PER_COMMAND
+                  && request_ready (c, r))
+                {
+                  list_remove (&r->elem);
+                  list_push_back (&batch, &r->elem);
+                  last = r;
+                  cnt += r->cnt;
+                  merged = true;
+                  break;
+                }
+            }
+        }
+      while (merged);
+      c->head = request_key (last->disk, last->sec_no + last->cnt);
+      lock_release (&c->queue_lock);
+
+      transfer (first->disk, &batch, cnt, first->write);
+
+      while (!list_empty (&batch))
+        {
+          struct disk_request *r = list_entry (list_pop_front (&batch),
+                                               struct disk_request, elem);
+          sema_up (&r->done);
+        }
+    }
+}
+
+/* Moves the CNT consecutive sectors of the requests in BATCH
+   between disk D and their buffers, to the disk if WRITE.  Each
+   command moves up to MAX_SECTORS_PER_COMMAND sectors,
+   interrupting once per D->multiple sectors if the disk supports
+   READ/WRITE MULTIPLE, else once per sector. */
+static void
+transfer (struct disk *d, struct list *batch, size_t cnt, bool write)
+{
+  struct channel *c = d->channel;
+  struct list_elem *e = list_begin (batch);
+  struct disk_request *r = list_entry (e, struct disk_request, elem);
+  disk_sector_t sec_no = r->sec_no;
+  size_t r_ofs = 0;
 
-  c = d->channel;
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  d->write_cnt++;
+  while (cnt > 0)
+    {
+      size_t n = cnt < MAX_SECTORS_PER_COMMAND ? cnt : MAX_SECTORS_PER_COMMAND;
+      size_t block = d->multiple > 1 && n > 1 ? (size_t) d->multiple : 1;
+      size_t i, j;
+
+      select_sector (d, sec_no, n);
+      if (write)
+        issue_pio_command (c, block > 1 ? CMD_WRITE_MULTIPLE
+                                        : CMD_WRITE_SECTOR_RETRY);
+      else
+        issue_pio_command (c, block > 1 ? CMD_READ_MULTIPLE
+                                        : CMD_READ_SECTOR_RETRY);
+      for (i = 0; i < n; i += block)
+        {
+          size_t left = n - i < block ? n - i : block;
+
+          if (!write)
+            sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+                   d->name, write ? "write" : "read", sec_no + i);
+          for (j = 0; j < left; j++)
+            {
+              uint8_t *sector;
+
+              /* Step to the next request's buffer. */
+              if (r_ofs == r->cnt)
+                {
+                  e = list_next (e);
+                  r = list_entry (e, struct disk_request, elem);
+                  r_ofs = 0;
+                }
+              sector = (uint8_t *) r->buffer + r_ofs++ * DISK_SECTOR_SIZE;
+              if (write)
+                output_sector (c, sector);
+              else
+                input_sector (c, sector);
+            }
+          if (write)
+            sema_down (&c->completion_wait);
+        }
+
+      if (write)
+        d->write_cnt += n;
+      else
+        d->read_cnt += n;
+      sec_no += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
-
+
 /* Disk detection and identification. */
 
 static void print_ata_string (char *string, size_t size);
@@ -402,6 +686,28 @@ identify_ata_device (struct disk *d)
   printf ("\", serial \"");
   print_ata_string ((char *) &id[10], 20);
   printf ("\"\n");
+
+  /* Low byte of word 47 is the most sectors READ/WRITE MULTIPLE
+     can move per interrupt, or 0 if they are not supported. */
+  if ((id[47] & 0xff) > 1)
+    set_multiple_mode (d, id[47] & 0xff);
+}
+
+/* Tells disk D to move BLOCK sectors per interrupt in READ and
+   WRITE MULTIPLE commands, and records that it does if the disk
+   accepts. */
+static void
+set_multiple_mode (struct disk *d, int block) 
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), block);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_alt_status (c)) & STA_ERR) == 0)
+    d->multiple = block;
 }
 
 /* Prints STRING, which consists of SIZE bytes in a funky format:
@@ -426,18 +732,19 @@ print_ata_string (char *string, size_t size)
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT of sectors to transfer to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) 
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) 
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < d->capacity);
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_COMMAND);
+  ASSERT (sec_no < d->capacity && cnt <= d->capacity - sec_no);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_SECTORS_PER_COMMAND);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
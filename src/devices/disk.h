@@ -2,7 +2,11 @@
 #define DEVICES_DISK_H
 
 #include <inttypes.h>
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include "threads/synch.h"
 
 /* Size of a disk sector in bytes. */
 #define DISK_SECTOR_SIZE 512
@@ -15,6 +19,24 @@ typedef uint32_t disk_sector_t;
    printf ("sector=%"PRDSNu"\n", sector); */
 #define PRDSNu PRIu32
 
+/* An asynchronous transfer of CNT consecutive sectors starting
+   at SEC_NO between DISK and BUFFER.  Set up with
+   disk_request_init(), queued with disk_submit(); DONE is up'd
+   once the transfer is complete, which disk_wait() waits for. */
+struct disk_request
+  {
+    struct disk *disk;          /* Disk to transfer to or from. */
+    disk_sector_t sec_no;       /* First sector. */
+    size_t cnt;                 /* Number of sectors. */
+    void *buffer;               /* CNT * DISK_SECTOR_SIZE bytes. */
+    bool write;                 /* True to write BUFFER, false to read. */
+    struct semaphore done;      /* Up'd when the transfer is complete. */
+
+    /* Owned by the disk driver. */
+    int64_t submitted;          /* Timer tick of disk_submit(). */
+    struct list_elem elem;      /* Element in the channel's queue. */
+  };
+
 void disk_init (void);
 void disk_print_stats (void);
 
@@ -22,5 +44,12 @@ struct disk *disk_get (int chan_no, int dev_no);
 disk_sector_t disk_size (struct disk *);
 void disk_read (struct disk *, disk_sector_t, void *);
 void disk_write (struct disk *, disk_sector_t, const void *);
+void disk_read_multi (struct disk *, disk_sector_t, void *, size_t);
+void disk_write_multi (struct disk *, disk_sector_t, const void *, size_t);
+
+void disk_request_init (struct disk_request *, struct disk *, disk_sector_t,
+                        void *buffer, size_t cnt, bool write);
+void disk_submit (struct disk_request *);
+void disk_wait (struct disk_request *);
 
 #endif /* devices/disk.h */
@@ -0,0 +1,107 @@
+/* fsbench.c
+
+   File system throughput benchmark.  Creates one file per
+   process, then runs that many child processes at once, each
+   reading its own file several times over and rewriting it in
+   place.  User programs have no clock, so compare the "Timer:"
+   line the kernel prints at shutdown between runs.
+
+   Usage: fsbench [PROCESSES [KILOBYTES]] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <syscall.h>
+
+#define MAX_PROCS 16
+#define PASSES 4
+
+static char buffer[4096];
+
+static void
+bench_name (char *name, size_t size, int i)
+{
+  snprintf (name, size, "fsbench.%d", i);
+}
+
+/* Reads file I PASSES times and then rewrites it. */
+static int
+child (int i)
+{
+  char name[32];
+  int fd, pass;
+
+  bench_name (name, sizeof name, i);
+  fd = open (name);
+  if (fd < 0)
+    {
+      printf ("%s: open failed\n", name);
+      return EXIT_FAILURE;
+    }
+
+  for (pass = 0; pass < PASSES; pass++)
+    {
+      seek (fd, 0);
+      while (read (fd, buffer, sizeof buffer) > 0)
+        continue;
+    }
+
+  seek (fd, 0);
+  while (tell (fd) < (unsigned) filesize (fd))
+    if (write (fd, buffer, sizeof buffer) <= 0)
+      break;
+
+  close (fd);
+  return EXIT_SUCCESS;
+}
+
+int
+main (int argc, char *argv[]) 
+{
+  pid_t pids[MAX_PROCS];
+  int procs = argc > 1 ? atoi (argv[1]) : 4;
+  int kb = argc > 2 ? atoi (argv[2]) : 64;
+  bool success = true;
+  int i;
+
+  if (argc == 3 && argv[1][0] == '-')
+    return child (atoi (argv[2]));
+
+  if (procs < 1 || procs > MAX_PROCS || kb < 1)
+    {
+      printf ("usage: fsbench [PROCESSES [KILOBYTES]]\n");
+      return EXIT_FAILURE;
+    }
+
+  /* Create the files. */
+  for (i = 0; i < procs; i++)
+    {
+      char name[32];
+      int fd, j;
+
+      bench_name (name, sizeof name, i);
+      remove (name);
+      if (!create (name, 0) || (fd = open (name)) < 0)
+        {
+          printf ("%s: create failed\n", name);
+          return EXIT_FAILURE;
+        }
+      for (j = 0; j < kb; j += sizeof buffer / 1024)
+        write (fd, buffer, sizeof buffer);
+      close (fd);
+    }
+
+  /* Run the children concurrently. */
+  for (i = 0; i < procs; i++)
+    {
+      char cmd[32];
+      snprintf (cmd, sizeof cmd, "fsbench - %d", i);
+      pids[i] = exec (cmd);
+    }
+  for (i = 0; i < procs; i++)
+    if (pids[i] < 0 || wait (pids[i]) != EXIT_SUCCESS)
+      success = false;
+
+  printf ("fsbench: %d processes, %d kB each: %s\n",
+          procs, kb, success ? "done" : "FAILED");
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
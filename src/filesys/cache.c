@@ -1,20 +1,90 @@
 #include "filesys/cache.h"
+#include "filesys/free-map.h"
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
+#include <round.h>
 #include "lib/kernel/hash.h"
-#include "threads/malloc.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "devices/timer.h"
 
-int CACHE_LIMIT = 64;
+/* Number of cache entries, set with the -cache-size kernel
+   option.  All entries are carved out of one pool at boot. */
+size_t cache_size = CACHE_DEFAULT_SIZE;
 
+/* Eviction policy, chosen with the -cache-policy kernel option. */
+enum cache_policy cache_policy = CACHE_CLOCK;
+static const char *cache_policy_names[] = {"fifo", "lru", "clock"};
+
+/* Statistics. */
+static long long cache_hit_cnt;
+static long long cache_miss_cnt;
+static long long cache_evict_cnt;
+
+/* Timer ticks between two runs of the flusher thread.  Bounds the
+   amount of dirty data a crash can lose. */
+#define CACHE_FLUSH_TICKS 100
+
+/* Pending read-ahead requests, consumed by the read-ahead thread.
+   Requests that find the queue full are dropped. */
+#define READ_AHEAD_QUEUE_SIZE 32
+struct read_ahead{
+  struct disk *disk;
+  disk_sector_t sec_no;
+};
+static struct read_ahead read_ahead_queue[READ_AHEAD_QUEUE_SIZE];
+/* Most sectors the read-ahead thread reads at once. */
+#define READ_AHEAD_BATCH 8
+static size_t read_ahead_head, read_ahead_cnt;
+static bool read_ahead_busy;            /* A batch is being read. */
+static struct lock read_ahead_lock;
+static struct condition read_ahead_ready;
+static struct condition read_ahead_idle;
+
+/* Protects the hash table, the list, the eviction state and the
+   pin counts, but not the sector data.  Never held across disk
+   I/O, so hits proceed while misses are outstanding. */
 struct lock lock_cache;
+/* Signaled when an entry's pin count drops to zero. */
+struct condition cache_unpinned;
 
-struct list FIFO_list;
+/* Entries in insertion order (FIFO), recency order (LRU, least
+   recent first) or clock order (CLOCK). */
+struct list cache_list;
+struct list_elem *clock_hand;
 struct hash buffer_cache;
 
+/* Preallocated entries, and those of them not holding a sector. */
+static struct cache *cache_pool;
+static struct list cache_free_list;
+
+/* cache_flush() copies up to FLUSH_BATCH dirty sectors into
+   flush_buffer and has them all written at once.  Both are
+   guarded by flush_lock. */
+#define FLUSH_BATCH 32
+static uint8_t *flush_buffer;
+static struct disk_request flush_requests[FLUSH_BATCH];
+static struct lock flush_lock;
+
+/* Set by cache_destroy().  Once it is, cache_flush() and the
+   read-ahead thread leave the cache alone.  Written holding both
+   flush_lock and read_ahead_lock, so either one suffices to read
+   it. */
+static bool cache_stopped;
+
 struct cache{
   struct disk *disk;
   disk_sector_t sec_no;
-  struct list_elem elem_list;
+  bool accessed;                /* Referenced since the clock hand passed. */
+  int pin_cnt;                  /* Users of this entry, never evicted while
+                                   nonzero.  Protected by lock_cache. */
+  struct rwlock rwlock;         /* Protects buffer and dirty.  Only taken
+                                   while pinned. */
+  bool dirty;                   /* Modified since last written to disk. */
+  struct list_elem elem_list;   /* cache_list or cache_free_list. */
   struct hash_elem elem_hash;
   char buffer[DISK_SECTOR_SIZE];
 };
@@ -22,19 +92,57 @@ struct cache{
 unsigned cache_hash_func (const struct hash_elem *, void *);
 bool cache_less_func (const struct hash_elem *,
     const struct hash_elem *, void *aux UNUSED);
-void cache_evict ();
+bool cache_evict ();
 struct cache *cache_allocate (struct disk *, disk_sector_t);
+static struct cache *cache_allocate_nowait (struct disk *, disk_sector_t);
+static void cache_discard (struct cache *);
+static struct cache *cache_lookup (disk_sector_t);
+static struct cache *cache_choose_evict (void);
+static struct cache *cache_acquire (struct disk *, disk_sector_t, bool, bool);
+static struct cache *cache_acquire_cached (disk_sector_t, bool);
+static void cache_release (struct cache *, bool, bool);
+static thread_func cache_flusher NO_RETURN;
+static thread_func cache_read_ahead_thread NO_RETURN;
+
+//write back pinned CACHE if it was modified since it was read;
+//lock_cache must not be held
+static void cache_write_back (struct cache *cache){
+  ASSERT (!lock_held_by_current_thread (&lock_cache));
+  ASSERT (cache->pin_cnt > 0);
+
+  rwlock_acquire_read (&cache->rwlock);
+  if (cache->dirty){
+    disk_write (cache->disk, cache->sec_no, cache->buffer);
+    cache->dirty = false;
+  }
+  rwlock_release_read (&cache->rwlock);
+}
 
 hash_action_func *cache_free (struct hash_elem *h, void *aux UNUSED){
   struct cache *cache = hash_entry (h, struct cache, elem_hash);
 
-  disk_write (cache->disk, cache->sec_no, cache->buffer);
-
-  free (cache);
+  ASSERT (cache->pin_cnt == 0);
+  if (cache->dirty)
+    disk_write (cache->disk, cache->sec_no, cache->buffer);
+  cache->dirty = false;
 }
 
 void cache_destroy (){
+  //wait for a flush in progress and for the read-ahead batch in
+  //flight, whose entries are pinned, then keep both away
+  lock_acquire (&flush_lock);
+  lock_acquire (&read_ahead_lock);
+  cache_stopped = true;
+  while (read_ahead_busy)
+    cond_wait (&read_ahead_idle, &read_ahead_lock);
+  lock_release (&read_ahead_lock);
+  lock_release (&flush_lock);
+
+  lock_acquire (&lock_cache);
   hash_destroy (&buffer_cache, cache_free);
+  list_init (&cache_list);
+  clock_hand = NULL;
+  lock_release (&lock_cache);
 }
 
 unsigned cache_hash_func (const struct hash_elem *p_, void *aux UNUSED){
@@ -49,29 +157,202 @@ bool cache_less_func (const struct hash_elem *a,
 }
 
 void cache_read (struct disk *disk, disk_sector_t sec_no, void *buffer){
+  struct cache *cache = cache_acquire (disk, sec_no, false, true);
+  memcpy (buffer, cache->buffer, DISK_SECTOR_SIZE);
+  cache_release (cache, false, false);
+}
+
+void cache_write (struct disk *disk, disk_sector_t sec_no, void *buffer){
+  //whole sector is overwritten, so a miss needs no disk read
+  struct cache *cache = cache_acquire (disk, sec_no, true, false);
+  memcpy (cache->buffer, buffer, DISK_SECTOR_SIZE);
+  cache_release (cache, true, true);
+}
+
+//return the entry for SEC_NO pinned and locked for reading, or for
+//writing if WRITE.  On a miss the sector is read from DISK if LOAD,
+//otherwise the caller must overwrite the whole buffer
+static struct cache *cache_acquire (struct disk *disk, disk_sector_t sec_no,
+                                    bool write, bool load){
+  struct cache *cache;
+
   lock_acquire (&lock_cache);
+  for (;;){
+    cache = cache_lookup (sec_no);
+    if (cache != NULL){
+      //a pending miss holds the write lock until the data is in
+      cache->pin_cnt++;
+      lock_release (&lock_cache);
+      if (write)
+        rwlock_acquire_write (&cache->rwlock);
+      else
+        rwlock_acquire_read (&cache->rwlock);
+      return cache;
+    }
 
-  struct cache *cache = get_cache (sec_no);
-  if(cache == NULL){
+    //allocation may drop lock_cache, so look the sector up again
     cache = cache_allocate (disk, sec_no);
-    disk_read (disk, sec_no, cache->buffer);
+    if (cache != NULL)
+      break;
   }
-  memcpy (buffer, cache->buffer, DISK_SECTOR_SIZE);
 
+  //fresh entry is invisible to others until the write lock drops
+  rwlock_acquire_write (&cache->rwlock);
   lock_release (&lock_cache);
+
+  if (load)
+    disk_read (disk, sec_no, cache->buffer);
+
+  if (!write){
+    rwlock_release_write (&cache->rwlock);
+    rwlock_acquire_read (&cache->rwlock);
+  }
+  return cache;
 }
 
-void cache_write (struct disk *disk, disk_sector_t sec_no, void *buffer){
+//as cache_acquire, but return NULL instead of caching SEC_NO on a
+//miss
+static struct cache *cache_acquire_cached (disk_sector_t sec_no, bool write){
+  struct cache *cache;
+
   lock_acquire (&lock_cache);
+  cache = get_cache (sec_no);
+  if (cache != NULL)
+    cache->pin_cnt++;
+  lock_release (&lock_cache);
 
-  struct cache *cache = get_cache (sec_no);
-  if(cache == NULL){
-    cache = cache_allocate (disk, sec_no);
-    disk_read (disk, sec_no, cache->buffer);
+  if (cache != NULL){
+    if (write)
+      rwlock_acquire_write (&cache->rwlock);
+    else
+      rwlock_acquire_read (&cache->rwlock);
   }
+  return cache;
+}
+
+//copy SEC_NO into BUFFER if it is cached; false, and nothing cached,
+//if it is not
+bool cache_read_cached (struct disk *disk UNUSED, disk_sector_t sec_no,
+                        void *buffer){
+  struct cache *cache = cache_acquire_cached (sec_no, false);
+
+  if (cache == NULL)
+    return false;
+  memcpy (buffer, cache->buffer, DISK_SECTOR_SIZE);
+  cache_release (cache, false, false);
+  return true;
+}
+
+//overwrite the cached copy of SEC_NO with BUFFER, if there is one,
+//marking it dirty if DIRTY.  False if SEC_NO is not cached
+bool cache_write_cached (struct disk *disk UNUSED, disk_sector_t sec_no,
+                         const void *buffer, bool dirty){
+  struct cache *cache = cache_acquire_cached (sec_no, true);
+
+  if (cache == NULL)
+    return false;
   memcpy (cache->buffer, buffer, DISK_SECTOR_SIZE);
+  cache_release (cache, true, dirty);
+  return true;
+}
+
+//unlock and unpin CACHE, marking it dirty if DIRTY
+static void cache_release (struct cache *cache, bool write, bool dirty){
+  if (write){
+    if (dirty)
+      cache->dirty = true;
+    rwlock_release_write (&cache->rwlock);
+  }
+  else{
+    ASSERT (!dirty);
+    rwlock_release_read (&cache->rwlock);
+  }
+
+  lock_acquire (&lock_cache);
+  ASSERT (cache->pin_cnt > 0);
+  if (--cache->pin_cnt == 0)
+    cond_broadcast (&cache_unpinned, &lock_cache);
+  lock_release (&lock_cache);
+}
+
+//zero-copy access: return a pointer to the cached data of SEC_NO,
+//pinned and locked for reading, or for writing if WRITE, until
+//it is handed back to cache_put
+void *cache_get (struct disk *disk, disk_sector_t sec_no, bool write){
+  return cache_acquire (disk, sec_no, write, true)->buffer;
+}
+
+//as cache_get for writing, but for a sector whose old contents do
+//not matter: the buffer is zeroed instead of read from disk
+void *cache_get_zeroed (struct disk *disk, disk_sector_t sec_no){
+  struct cache *cache = cache_acquire (disk, sec_no, true, false);
+  memset (cache->buffer, 0, DISK_SECTOR_SIZE);
+  return cache->buffer;
+}
+
+//give back BUFFER obtained from cache_get, marking it dirty if DIRTY
+void cache_put (void *buffer, bool dirty){
+  struct cache *cache = (struct cache *) ((char *) buffer
+                                          - offsetof (struct cache, buffer));
+
+  cache_release (cache, rwlock_held_by_current_thread (&cache->rwlock), dirty);
+}
+
+//write every dirty entry back to disk, keeping them cached.  Dirty
+//data is copied out so no entry stays locked while its write is
+//queued, and written FLUSH_BATCH sectors at a time, letting the disk
+//scheduler sort and merge them.  The disk queue keeps a later read
+//of a sector behind its queued write
+void cache_flush (void){
+  struct list_elem *e;
+  struct cache *cache;
+  size_t i, n = 0;
+
+  lock_acquire (&flush_lock);
+  if (cache_stopped){
+    lock_release (&flush_lock);
+    return;
+  }
+  lock_acquire (&lock_cache);
+  e = list_begin (&cache_list);
+  while (e != list_end (&cache_list)){
+    cache = list_entry (e, struct cache, elem_list);
+    if (!cache->dirty){
+      e = list_next (e);
+      continue;
+    }
+
+    //pinned, so E stays on the list while lock_cache is dropped
+    cache->pin_cnt++;
+    lock_release (&lock_cache);
 
+    rwlock_acquire_read (&cache->rwlock);
+    if (cache->dirty){
+      uint8_t *copy = flush_buffer + n * DISK_SECTOR_SIZE;
+      memcpy (copy, cache->buffer, DISK_SECTOR_SIZE);
+      cache->dirty = false;
+      disk_request_init (&flush_requests[n], cache->disk, cache->sec_no,
+                         copy, 1, true);
+      disk_submit (&flush_requests[n++]);
+    }
+    rwlock_release_read (&cache->rwlock);
+
+    if (n == FLUSH_BATCH){
+      for (i = 0; i < n; i++)
+        disk_wait (&flush_requests[i]);
+      n = 0;
+    }
+
+    lock_acquire (&lock_cache);
+    e = list_next (e);
+    if (--cache->pin_cnt == 0)
+      cond_broadcast (&cache_unpinned, &lock_cache);
+  }
   lock_release (&lock_cache);
+
+  for (i = 0; i < n; i++)
+    disk_wait (&flush_requests[i]);
+  lock_release (&flush_lock);
 }
 
 struct cache *get_cache (disk_sector_t sector){
@@ -85,41 +366,302 @@ struct cache *get_cache (disk_sector_t sector){
   return hash_entry(hash_elem, struct cache, elem_hash);
 }
 
+//look SECTOR up and record the reference for the eviction policy
+static struct cache *cache_lookup (disk_sector_t sector){
+  struct cache *cache = get_cache (sector);
+
+  if (cache == NULL){
+    cache_miss_cnt++;
+    return NULL;
+  }
+
+  cache_hit_cnt++;
+  cache->accessed = true;
+  if (cache_policy == CACHE_LRU){
+    list_remove (&cache->elem_list);
+    list_push_back (&cache_list, &cache->elem_list);
+  }
+  return cache;
+}
+
+//select the eviction policy by NAME, false if there is no such policy
+bool cache_set_policy (const char *name){
+  size_t i;
+
+  for (i = 0; i < sizeof cache_policy_names / sizeof *cache_policy_names; i++)
+    if (!strcmp (name, cache_policy_names[i])){
+      cache_policy = i;
+      return true;
+    }
+  return false;
+}
+
+void cache_print_stats (void){
+  printf ("Cache: %lld hits, %lld misses, %lld evictions (%s)\n",
+          cache_hit_cnt, cache_miss_cnt, cache_evict_cnt,
+          cache_policy_names[cache_policy]);
+}
+
+//set the number of cache entries, false if SIZE is too small.
+//cache_init() caps it at what the kernel pool can hold
+bool cache_set_size (int size){
+  if (size < CACHE_MIN_SIZE)
+    return false;
+  cache_size = size;
+  return true;
+}
+
 void cache_init (){
+  size_t i, max_size;
+
+  // leave at least half of the kernel pool for everything else
+  max_size = palloc_free_cnt (0) / 2 * PGSIZE / sizeof *cache_pool;
+  if (cache_size > max_size){
+    printf ("Cache: %zu sectors do not fit in the kernel pool, "
+            "using %zu\n", cache_size, max_size);
+    cache_size = max_size;
+  }
+
   lock_init (&lock_cache);
-  list_init (&FIFO_list);
+  cond_init (&cache_unpinned);
+  list_init (&cache_list);
+  clock_hand = NULL;
   hash_init (&buffer_cache, cache_hash_func, cache_less_func, NULL);
+
+  cache_pool = palloc_get_multiple (PAL_ASSERT,
+                                    DIV_ROUND_UP (cache_size * sizeof *cache_pool,
+                                                  PGSIZE));
+  list_init (&cache_free_list);
+  for (i = 0; i < cache_size; i++){
+    rwlock_init (&cache_pool[i].rwlock);
+    list_push_back (&cache_free_list, &cache_pool[i].elem_list);
+  }
+
+  flush_buffer = palloc_get_multiple (PAL_ASSERT,
+                                      DIV_ROUND_UP (FLUSH_BATCH
+                                                    * DISK_SECTOR_SIZE,
+                                                    PGSIZE));
+  lock_init (&flush_lock);
+
+  lock_init (&read_ahead_lock);
+  cond_init (&read_ahead_ready);
+  cond_init (&read_ahead_idle);
+  read_ahead_head = read_ahead_cnt = 0;
+
+  thread_create ("cache_flusher", PRI_DEFAULT, cache_flusher, NULL);
+  thread_create ("cache_read_ahead", PRI_DEFAULT,
+                 cache_read_ahead_thread, NULL);
+}
+
+//ask the read-ahead thread to bring SEC_NO into the cache without
+//waiting for it
+void cache_read_ahead (struct disk *disk, disk_sector_t sec_no){
+  lock_acquire (&read_ahead_lock);
+  if (read_ahead_cnt < READ_AHEAD_QUEUE_SIZE){
+    struct read_ahead *ra = &read_ahead_queue[(read_ahead_head + read_ahead_cnt)
+                                              % READ_AHEAD_QUEUE_SIZE];
+    ra->disk = disk;
+    ra->sec_no = sec_no;
+    read_ahead_cnt++;
+    cond_signal (&read_ahead_ready, &read_ahead_lock);
+  }
+  lock_release (&read_ahead_lock);
+}
+
+//fill the cache with queued sectors, submitting up to
+//READ_AHEAD_BATCH reads before waiting for any.  Sectors already
+//cached are skipped without counting as a reference, and so are
+//sectors for which no entry is free without waiting or a write back
+static void cache_read_ahead_thread (void *aux UNUSED){
+  struct disk_request requests[READ_AHEAD_BATCH];
+  struct cache *entries[READ_AHEAD_BATCH];
+  struct read_ahead ra;
+  size_t i, n;
+
+  for (;;){
+    lock_acquire (&read_ahead_lock);
+    while (read_ahead_cnt == 0 || cache_stopped)
+      cond_wait (&read_ahead_ready, &read_ahead_lock);
+    read_ahead_busy = true;
+
+    for (n = 0; n < READ_AHEAD_BATCH && read_ahead_cnt > 0; ){
+      ra = read_ahead_queue[read_ahead_head];
+      read_ahead_head = (read_ahead_head + 1) % READ_AHEAD_QUEUE_SIZE;
+      read_ahead_cnt--;
+
+      lock_acquire (&lock_cache);
+      struct cache *cache = NULL;
+      if (get_cache (ra.sec_no) == NULL)
+        cache = cache_allocate_nowait (ra.disk, ra.sec_no);
+      //invisible to others until the write lock drops, as in
+      //cache_acquire
+      if (cache != NULL)
+        rwlock_acquire_write (&cache->rwlock);
+      lock_release (&lock_cache);
+
+      if (cache != NULL){
+        disk_request_init (&requests[n], ra.disk, ra.sec_no, cache->buffer,
+                           1, false);
+        disk_submit (&requests[n]);
+        entries[n++] = cache;
+      }
+    }
+    lock_release (&read_ahead_lock);
+
+    for (i = 0; i < n; i++){
+      disk_wait (&requests[i]);
+      cache_release (entries[i], true, false);
+    }
+
+    lock_acquire (&read_ahead_lock);
+    read_ahead_busy = false;
+    cond_broadcast (&read_ahead_idle, &read_ahead_lock);
+    lock_release (&read_ahead_lock);
+  }
 }
 
-//evict cache from buffer and write to disk
-void cache_evict (){
-  ASSERT (hash_size(&buffer_cache)==CACHE_LIMIT);
+//periodically write dirty entries back so a crash loses bounded data
+static void cache_flusher (void *aux UNUSED){
+  for (;;){
+    timer_sleep (CACHE_FLUSH_TICKS);
+    free_map_flush ();
+    cache_flush ();
+  }
+}
+
+//second-chance sweep: skip and clear entries referenced since the
+//hand last passed them, evict the first one that was not.  Pinned
+//entries are passed over; gives up after two full turns
+static struct cache *cache_clock_evict (void){
+  struct cache *cache;
+  size_t i, n = 2 * list_size (&cache_list);
+
+  for (i = 0; i < n; i++){
+    if (clock_hand == NULL || clock_hand == list_end (&cache_list))
+      clock_hand = list_begin (&cache_list);
 
+    cache = list_entry (clock_hand, struct cache, elem_list);
+    clock_hand = list_next (clock_hand);
+
+    if (cache->pin_cnt > 0)
+      continue;
+    if (!cache->accessed)
+      return cache;
+    cache->accessed = false;
+  }
+  return NULL;
+}
+
+//first unpinned entry from the front of the list
+static struct cache *cache_front_evict (void){
   struct list_elem *e;
+  struct cache *cache;
+
+  for (e = list_begin (&cache_list); e != list_end (&cache_list);
+       e = list_next (e)){
+    cache = list_entry (e, struct cache, elem_list);
+    if (cache->pin_cnt == 0)
+      return cache;
+  }
+  return NULL;
+}
+
+//pick an unpinned victim, or null if every entry is pinned
+static struct cache *cache_choose_evict (void){
+  ASSERT (!list_empty (&cache_list));
+
+  switch (cache_policy){
+    case CACHE_CLOCK:
+      return cache_clock_evict ();
+    case CACHE_FIFO:
+    case CACHE_LRU:
+    default:
+      return cache_front_evict ();
+  }
+}
+
+//evict one entry from the buffer.  A dirty victim is written back
+//with lock_cache released instead, and false is returned so the
+//caller retries; false also after waiting for an entry to unpin
+bool cache_evict (){
+  ASSERT (lock_held_by_current_thread (&lock_cache));
+  ASSERT (list_empty (&cache_free_list));
+
   struct cache *cache_evict;
 
-  cache_evict = list_entry(list_pop_front (&FIFO_list), struct cache, elem_list);
-  ASSERT (cache_evict != NULL);
+  cache_evict = cache_choose_evict ();
+  if (cache_evict == NULL){
+    cond_wait (&cache_unpinned, &lock_cache);
+    return false;
+  }
+
+  if (cache_evict->dirty){
+    cache_evict->pin_cnt++;
+    lock_release (&lock_cache);
+    cache_write_back (cache_evict);
+    lock_acquire (&lock_cache);
+    if (--cache_evict->pin_cnt == 0)
+      cond_broadcast (&cache_unpinned, &lock_cache);
+    return false;
+  }
 
-  struct hash_elem *old_elem = hash_delete (&buffer_cache, &cache_evict->elem_hash);
+  cache_discard (cache_evict);
+  return true;
+}
+
+//move clean, unpinned CACHE to the free list
+static void cache_discard (struct cache *cache){
+  ASSERT (lock_held_by_current_thread (&lock_cache));
+  ASSERT (cache->pin_cnt == 0 && !cache->dirty);
+
+  if (clock_hand == &cache->elem_list)
+    clock_hand = list_next (clock_hand);
+  list_remove (&cache->elem_list);
+  cache_evict_cnt++;
+
+  struct hash_elem *old_elem = hash_delete (&buffer_cache, &cache->elem_hash);
   ASSERT (old_elem != NULL);
 
-  disk_write (cache_evict->disk, cache_evict->sec_no, cache_evict->buffer);
+  list_push_back (&cache_free_list, &cache->elem_list);
+}
+
+//as cache_allocate, but never drops lock_cache: returns null
+//instead of waiting for an entry to unpin or writing one back
+static struct cache *cache_allocate_nowait (struct disk *disk,
+                                            disk_sector_t sec_no){
+  ASSERT (lock_held_by_current_thread (&lock_cache));
 
-  free (cache_evict);
+  if (list_empty (&cache_free_list)){
+    struct cache *victim = cache_choose_evict ();
+    if (victim == NULL || victim->dirty)
+      return NULL;
+    cache_discard (victim);
+  }
+  return cache_allocate (disk, sec_no);
 }
 
+//add an entry for SEC_NO, with its pin held by the caller.  Returns
+//null if lock_cache had to be dropped, since SEC_NO may have been
+//added by someone else meanwhile
 struct cache *cache_allocate (struct disk *disk, disk_sector_t sec_no){
-  if (hash_size(&buffer_cache) == CACHE_LIMIT){
-    cache_evict();
-  }
+  if (list_empty (&cache_free_list) && !cache_evict ())
+    return NULL;
 
   struct cache *cache;
-  cache = (struct cache *)malloc (sizeof(struct cache));
+  cache = list_entry (list_pop_front (&cache_free_list),
+                      struct cache, elem_list);
   cache->disk = disk;
   cache->sec_no = sec_no;
+  cache->dirty = false;
+  cache->accessed = false;
+  cache->pin_cnt = 1;
 
-  list_push_back (&FIFO_list, &cache->elem_list);
+  //under CLOCK, new entries go just behind the hand so they get a
+  //full sweep before being considered
+  if (cache_policy == CACHE_CLOCK && clock_hand != NULL)
+    list_insert (clock_hand, &cache->elem_list);
+  else
+    list_push_back (&cache_list, &cache->elem_list);
   hash_insert (&buffer_cache, &cache->elem_hash);
 
   return cache;
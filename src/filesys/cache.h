@@ -1,7 +1,34 @@
+#include <stdbool.h>
+#include <stddef.h>
 #include "devices/disk.h"
 
+/* Default and minimum number of buffer cache entries. */
+#define CACHE_DEFAULT_SIZE 64
+#define CACHE_MIN_SIZE 8
+
+/* Buffer cache eviction policies. */
+enum cache_policy
+  {
+    CACHE_FIFO,                 /* First in, first out. */
+    CACHE_LRU,                  /* Least recently used. */
+    CACHE_CLOCK                 /* Second chance on accessed bit. */
+  };
+
+extern enum cache_policy cache_policy;
+extern size_t cache_size;
+
 void cache_destroy();
 void cache_init();
 struct cache *get_cache (disk_sector_t);
 void cache_read (struct disk *, disk_sector_t, void *);
 void cache_write (struct disk *, disk_sector_t, void *);
+bool cache_read_cached (struct disk *, disk_sector_t, void *);
+bool cache_write_cached (struct disk *, disk_sector_t, const void *, bool);
+void *cache_get (struct disk *, disk_sector_t, bool);
+void *cache_get_zeroed (struct disk *, disk_sector_t);
+void cache_put (void *, bool);
+void cache_flush (void);
+void cache_read_ahead (struct disk *, disk_sector_t);
+bool cache_set_policy (const char *);
+bool cache_set_size (int);
+void cache_print_stats (void);
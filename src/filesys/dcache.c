@@ -0,0 +1,180 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "filesys/directory.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Result of looking up NAME in the directory whose inode is at
+   sector PARENT.  A negative entry records that NAME does not
+   exist there. */
+struct dentry
+  {
+    disk_sector_t parent;               /* Directory inode sector. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+    bool exists;                        /* False for a negative entry. */
+    disk_sector_t sector;               /* Inode sector of NAME. */
+    struct hash_elem hash_elem;         /* Element in dcache. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+  };
+
+static struct hash dcache;              /* Entries by (parent, name). */
+static struct list dcache_lru;          /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects the two above. */
+
+static unsigned dentry_hash (const struct hash_elem *, void *);
+static bool dentry_less (const struct hash_elem *, const struct hash_elem *,
+                         void *);
+static struct dentry *dentry_find (disk_sector_t, const char *);
+static void dentry_delete (struct dentry *);
+
+/* Initializes the dentry cache. */
+void
+dcache_init (void)
+{
+  hash_init (&dcache, dentry_hash, dentry_less, NULL);
+  list_init (&dcache_lru);
+  lock_init (&dcache_lock);
+}
+
+/* Looks up NAME in directory PARENT.  On a hit, returns true and
+   sets *EXISTS, and *SECTORP if NAME exists.  Returns false if
+   nothing is cached for NAME. */
+bool
+dcache_lookup (disk_sector_t parent, const char *name,
+               bool *exists, disk_sector_t *sectorp)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (parent, name);
+  if (d != NULL)
+    {
+      *exists = d->exists;
+      if (d->exists)
+        *sectorp = d->sector;
+      list_remove (&d->lru_elem);
+      list_push_front (&dcache_lru, &d->lru_elem);
+    }
+  lock_release (&dcache_lock);
+
+  return d != NULL;
+}
+
+/* Records that NAME in directory PARENT is the inode at SECTOR,
+   or, if EXISTS is false, that there is no NAME.  Drops the least
+   recently used entry when the cache is full. */
+void
+dcache_insert (disk_sector_t parent, const char *name,
+               bool exists, disk_sector_t sector)
+{
+  struct dentry *d;
+
+  if (strlen (name) > NAME_MAX)
+    return;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (parent, name);
+  if (d == NULL)
+    {
+      if (hash_size (&dcache) >= DCACHE_SIZE)
+        dentry_delete (list_entry (list_back (&dcache_lru),
+                                   struct dentry, lru_elem));
+
+      d = malloc (sizeof *d);
+      if (d == NULL)
+        {
+          lock_release (&dcache_lock);
+          return;
+        }
+      d->parent = parent;
+      strlcpy (d->name, name, sizeof d->name);
+      hash_insert (&dcache, &d->hash_elem);
+    }
+  else
+    list_remove (&d->lru_elem);
+
+  d->exists = exists;
+  d->sector = sector;
+  list_push_front (&dcache_lru, &d->lru_elem);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets whatever is cached for NAME in directory PARENT. */
+void
+dcache_invalidate (disk_sector_t parent, const char *name)
+{
+  struct dentry *d;
+
+  lock_acquire (&dcache_lock);
+  d = dentry_find (parent, name);
+  if (d != NULL)
+    dentry_delete (d);
+  lock_release (&dcache_lock);
+}
+
+/* Forgets every entry of directory PARENT, which is being
+   removed, so that its sector can be reused. */
+void
+dcache_purge (disk_sector_t parent)
+{
+  struct list_elem *e, *next;
+
+  lock_acquire (&dcache_lock);
+  for (e = list_begin (&dcache_lru); e != list_end (&dcache_lru); e = next)
+    {
+      struct dentry *d = list_entry (e, struct dentry, lru_elem);
+      next = list_next (e);
+      if (d->parent == parent)
+        dentry_delete (d);
+    }
+  lock_release (&dcache_lock);
+}
+
+/* Returns the entry for NAME in PARENT, or a null pointer.
+   The caller must hold dcache_lock. */
+static struct dentry *
+dentry_find (disk_sector_t parent, const char *name)
+{
+  struct dentry key;
+  struct hash_elem *e;
+
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+
+  key.parent = parent;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&dcache, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dentry, hash_elem) : NULL;
+}
+
+/* Removes D from the cache and frees it.
+   The caller must hold dcache_lock. */
+static void
+dentry_delete (struct dentry *d)
+{
+  hash_delete (&dcache, &d->hash_elem);
+  list_remove (&d->lru_elem);
+  free (d);
+}
+
+static unsigned
+dentry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dentry *d = hash_entry (e, struct dentry, hash_elem);
+  return hash_string (d->name) ^ hash_bytes (&d->parent, sizeof d->parent);
+}
+
+static bool
+dentry_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+  const struct dentry *a = hash_entry (a_, struct dentry, hash_elem);
+  const struct dentry *b = hash_entry (b_, struct dentry, hash_elem);
+
+  if (a->parent != b->parent)
+    return a->parent < b->parent;
+  return strcmp (a->name, b->name) < 0;
+}
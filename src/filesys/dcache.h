@@ -0,0 +1,18 @@
+#ifndef FILESYS_DCACHE_H
+#define FILESYS_DCACHE_H
+
+#include <stdbool.h>
+#include "devices/disk.h"
+
+/* Maximum number of cached directory entries. */
+#define DCACHE_SIZE 128
+
+void dcache_init (void);
+bool dcache_lookup (disk_sector_t parent, const char *name,
+                    bool *exists, disk_sector_t *sectorp);
+void dcache_insert (disk_sector_t parent, const char *name,
+                    bool exists, disk_sector_t sector);
+void dcache_invalidate (disk_sector_t parent, const char *name);
+void dcache_purge (disk_sector_t parent);
+
+#endif /* filesys/dcache.h */
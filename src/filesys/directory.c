@@ -1,7 +1,11 @@
 #include "filesys/directory.h"
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -15,6 +19,37 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* An indexed directory is a hash table of buckets, one disk
+   sector each, addressed by the hash of the entry name.  A name
+   that does not fit its bucket goes into the next bucket that has
+   room.  A free entry whose name is empty was never used and ends
+   a search.  A removed entry keeps its name and does not. */
+#define DIR_BUCKET_ENTRIES (DISK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* One bucket of an indexed directory.  The bytes left over at the
+   end of the sector are unused. */
+struct dir_bucket
+  {
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+  };
+
+/* Buckets a new indexed directory starts with. */
+#define DIR_MIN_BUCKETS 4
+
+/* An insert that would have to look at more buckets than this
+   doubles the table instead. */
+#define DIR_MAX_PROBE 4
+
+bool dir_use_index;
+
+static bool is_indexed (const struct dir *);
+static bool read_bucket (struct inode *, size_t, struct dir_bucket *);
+static bool lookup_indexed (const struct dir *, const char *,
+                            struct dir_entry *, off_t *);
+static bool add_indexed (struct dir *, const struct dir_entry *);
+static bool rehash (struct dir *, size_t);
+static bool next_entry (struct dir *, char name[NAME_MAX + 1]);
+
 bool dir_chdir (char *path){
   struct dir *dir = dir_open_path (path);
 
@@ -58,13 +93,30 @@ bool split_path_name (char *path_, char *path, char *name){
 }
 
 /* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+   given SECTOR, with a hash index if INDEXED, and adds its "."
+   entry.  Returns true if successful, false on failure. */
 bool
-dir_create (disk_sector_t sector, size_t entry_cnt) 
+dir_create (disk_sector_t sector, size_t entry_cnt, bool indexed) 
 {
-  bool success = inode_create (sector, entry_cnt * sizeof (struct dir_entry), true);
-  struct dir *dir = dir_open_root ();
-  ASSERT (dir_add (dir, ".", ROOT_DIR_SECTOR));
+  size_t buckets = 0;
+  off_t size = entry_cnt * sizeof (struct dir_entry);
+
+  if (indexed){
+    buckets = DIV_ROUND_UP (entry_cnt, DIR_BUCKET_ENTRIES);
+    if (buckets < DIR_MIN_BUCKETS)
+      buckets = DIR_MIN_BUCKETS;
+    size = buckets * DISK_SECTOR_SIZE;
+  }
+
+  if (!inode_create (sector, size, true))
+    return false;
+
+  struct dir *dir = dir_open (inode_open (sector));
+  if (dir == NULL)
+    return false;
+  if (indexed)
+    inode_set_dir_buckets (dir->inode, buckets);
+  bool success = dir_add (dir, ".", sector);
   dir_close(dir);
   return success;
 }
@@ -207,6 +259,9 @@ lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  if (is_indexed (dir))
+    return lookup_indexed (dir, name, ep, ofsp);
+
   for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
        ofs += sizeof e){
     if (e.in_use && !strcmp (name, e.name)) 
@@ -230,18 +285,35 @@ dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
   struct dir_entry e;
+  disk_sector_t parent, sector;
+  bool exists;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  parent = inode_get_inumber (dir->inode);
+
   if (!strlen(name))
     *inode = dir->inode;
 
-  else if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-
-  else
-    *inode = NULL;
+  else{
+    // dir_remove() invalidates the cache under dir_lock, so holding
+    // it keeps the sector found, cached or not, from being freed
+    // before it is opened, and keeps updates from slipping in
+    // between a lookup and caching its result
+    lock_acquire (&dir->inode->dir_lock);
+    if (dcache_lookup (parent, name, &exists, &sector))
+      *inode = exists ? inode_open (sector) : NULL;
+    else if (lookup (dir, name, &e, NULL)){
+      dcache_insert (parent, name, true, e.inode_sector);
+      *inode = inode_open (e.inode_sector);
+    }
+    else{
+      dcache_insert (parent, name, false, 0);
+      *inode = NULL;
+    }
+    lock_release (&dir->inode->dir_lock);
+  }
 
   return *inode != NULL;
 }
@@ -266,10 +338,25 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  lock_acquire (&dir->inode->dir_lock);
+
+  /* Nothing may be added to a removed directory. */
+  if (dir->inode->removed)
+    goto done;
+
   /* Check that NAME is not in use. */
   if (lookup (dir, name, NULL, NULL))
     goto done;
 
+  if (is_indexed (dir)){
+    memset (&e, 0, sizeof e);
+    e.in_use = true;
+    strlcpy (e.name, name, sizeof e.name);
+    e.inode_sector = inode_sector;
+    success = add_indexed (dir, &e);
+    goto done;
+  }
+
   /* Set OFS to offset of free slot.
      If there are no free slots, then it will be set to the
      current end-of-file.
@@ -289,6 +376,10 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector)
   int size = inode_write_at (dir->inode, &e, sizeof e, ofs);
   success = size == sizeof e;
  done:
+  // drop a negative entry for NAME
+  if (success)
+    dcache_invalidate (inode_get_inumber (dir->inode), name);
+  lock_release (&dir->inode->dir_lock);
   return success;
 }
 
@@ -301,11 +392,19 @@ dir_remove (struct dir *dir, const char *name)
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
+  bool child_locked = false;
   off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  /* Directories are locked parent first, so neither "." nor ".."
+     can be removed. */
+  if (!strcmp (name, ".") || !strcmp (name, ".."))
+    return false;
+
+  lock_acquire (&dir->inode->dir_lock);
+
   /* Find directory entry. */
   if (!lookup (dir, name, &e, &ofs))
     goto done;
@@ -319,9 +418,15 @@ dir_remove (struct dir *dir, const char *name)
     if (inode->open_cnt > 1)
       goto done;
 
+    // keep entries from being added until the directory is removed
+    lock_acquire (&inode->dir_lock);
+    child_locked = true;
+
     char name [NAME_MAX + 1];
-    struct dir *dir2 = dir_open (inode);
-    if (dir_readdir (dir2, name)){
+    struct dir *dir2 = dir_open (inode_reopen (inode));
+    if (dir2 == NULL)
+      goto done;
+    if (next_entry (dir2, name)){
       dir_close (dir2);
       goto done;
     }
@@ -332,12 +437,18 @@ dir_remove (struct dir *dir, const char *name)
   e.in_use = false;
   if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
     goto done;
+  dcache_invalidate (inode_get_inumber (dir->inode), name);
+  if ((inode->data).is_dir)
+    dcache_purge (e.inode_sector);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  if (child_locked)
+    lock_release (&inode->dir_lock);
+  lock_release (&dir->inode->dir_lock);
   inode_close (inode);
   return success;
 }
@@ -347,11 +458,30 @@ dir_remove (struct dir *dir, const char *name)
    contains no more entries. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
+{
+  bool success;
+
+  lock_acquire (&dir->inode->dir_lock);
+  success = next_entry (dir, name);
+  lock_release (&dir->inode->dir_lock);
+  return success;
+}
+
+/* dir_readdir() for a caller that holds DIR's dir_lock. */
+static bool
+next_entry (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  for (;;)
     {
+      // entries of an indexed directory do not cross sectors
+      if (is_indexed (dir)
+          && dir->pos % DISK_SECTOR_SIZE + sizeof e > DISK_SECTOR_SIZE)
+        dir->pos = ROUND_UP (dir->pos, DISK_SECTOR_SIZE);
+      if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+        break;
+
       dir->pos += sizeof e;
       if (e.in_use)
         {
@@ -364,3 +494,137 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
     }
   return false;
 }
+
+/* Returns true if DIR has a hash index. */
+static bool
+is_indexed (const struct dir *dir)
+{
+  return dir->inode->data.dir_buckets != 0;
+}
+
+/* Reads bucket IDX of indexed directory INODE into B. */
+static bool
+read_bucket (struct inode *inode, size_t idx, struct dir_bucket *b)
+{
+  return inode_read_at (inode, b, sizeof *b, idx * DISK_SECTOR_SIZE)
+         == sizeof *b;
+}
+
+/* lookup() for an indexed directory: probes buckets starting with
+   the one NAME hashes to, until NAME or a never used entry is
+   found. */
+static bool
+lookup_indexed (const struct dir *dir, const char *name,
+                struct dir_entry *ep, off_t *ofsp)
+{
+  size_t buckets = dir->inode->data.dir_buckets;
+  size_t first = hash_string (name) % buckets;
+  struct dir_bucket b;
+  size_t i, j;
+
+  for (i = 0; i < buckets; i++){
+    size_t idx = (first + i) % buckets;
+    if (!read_bucket (dir->inode, idx, &b))
+      return false;
+
+    for (j = 0; j < DIR_BUCKET_ENTRIES; j++){
+      struct dir_entry *e = &b.entries[j];
+      if (e->in_use && !strcmp (name, e->name)){
+        if (ep != NULL)
+          *ep = *e;
+        if (ofsp != NULL)
+          *ofsp = idx * DISK_SECTOR_SIZE + j * sizeof *e;
+        return true;
+      }
+      if (!e->in_use && e->name[0] == '\0')
+        return false;
+    }
+  }
+  return false;
+}
+
+/* Stores E in the first free entry of the buckets probed for its
+   name, doubling the table when none of the first DIR_MAX_PROBE
+   buckets has room. */
+static bool
+add_indexed (struct dir *dir, const struct dir_entry *e)
+{
+  struct dir_bucket b;
+  size_t i, j;
+
+  for (;;){
+    size_t buckets = dir->inode->data.dir_buckets;
+    size_t first = hash_string (e->name) % buckets;
+    bool can_grow = buckets * 2 <= UINT16_MAX;
+    size_t probe = can_grow && buckets > DIR_MAX_PROBE ? DIR_MAX_PROBE
+                                                       : buckets;
+
+    for (i = 0; i < probe; i++){
+      size_t idx = (first + i) % buckets;
+      if (!read_bucket (dir->inode, idx, &b))
+        return false;
+
+      for (j = 0; j < DIR_BUCKET_ENTRIES; j++)
+        if (!b.entries[j].in_use){
+          off_t ofs = idx * DISK_SECTOR_SIZE + j * sizeof *e;
+          return inode_write_at (dir->inode, e, sizeof *e, ofs) == sizeof *e;
+        }
+    }
+
+    if (!can_grow || !rehash (dir, buckets * 2))
+      return false;
+  }
+}
+
+/* Rebuilds the index of DIR with BUCKETS buckets, dropping removed
+   entries. */
+static bool
+rehash (struct dir *dir, size_t buckets)
+{
+  size_t old_buckets = dir->inode->data.dir_buckets;
+  off_t size = buckets * DISK_SECTOR_SIZE;
+  struct dir_bucket *old = malloc (old_buckets * sizeof *old);
+  uint8_t *table = calloc (buckets, DISK_SECTOR_SIZE);
+  bool success = false;
+  size_t i, j, k;
+
+  if (old == NULL || table == NULL)
+    goto done;
+
+  for (i = 0; i < old_buckets; i++)
+    if (!read_bucket (dir->inode, i, &old[i]))
+      goto done;
+
+  for (i = 0; i < old_buckets; i++)
+    for (j = 0; j < DIR_BUCKET_ENTRIES; j++){
+      struct dir_entry *e = &old[i].entries[j];
+      if (!e->in_use)
+        continue;
+
+      // twice the room, so some bucket has a free entry
+      size_t idx = hash_string (e->name) % buckets;
+      struct dir_bucket *b;
+      for (;;){
+        b = (struct dir_bucket *) (table + idx * DISK_SECTOR_SIZE);
+        for (k = 0; k < DIR_BUCKET_ENTRIES; k++)
+          if (!b->entries[k].in_use)
+            break;
+        if (k < DIR_BUCKET_ENTRIES)
+          break;
+        idx = (idx + 1) % buckets;
+      }
+      b->entries[k] = *e;
+    }
+
+  // whole sectors, so the padding at the end of each bucket is zeroed
+  if (inode_write_at (dir->inode, table, size, 0) != size)
+    goto done;
+
+  inode_set_dir_buckets (dir->inode, buckets);
+  success = true;
+
+ done:
+  free (old);
+  free (table);
+  return success;
+}
@@ -15,6 +15,9 @@
 
 struct inode;
 
+/* If true, new directories are created with a hash index. */
+extern bool dir_use_index;
+
 /* A directory. */
 struct dir
   {
@@ -27,7 +30,7 @@ bool dir_chdir (char *);
 bool split_path_name (char *, char *, char *);
 
 /* Opening and closing directories. */
-bool dir_create (disk_sector_t sector, size_t entry_cnt);
+bool dir_create (disk_sector_t sector, size_t entry_cnt, bool indexed);
 struct dir *dir_open (struct inode *);
 struct dir *dir_open_path (char *);
 struct dir *dir_open_root (void);
@@ -6,6 +6,7 @@
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/directory.h"
 #include "devices/disk.h"
 
@@ -24,12 +25,14 @@ filesys_init (bool format)
     PANIC ("hd0:1 (hdb) not present, file system initialization failed");
 
   inode_init ();
+  dcache_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
   free_map_open ();
+  inode_adopt_layout (FREE_MAP_SECTOR);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -59,14 +62,15 @@ filesys_create (const char *path_, off_t initial_size, bool is_dir)
   
   bool success = (dir != NULL
                   && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size, is_dir)
+                  && (is_dir
+                      ? dir_create (inode_sector, 16, dir_use_index)
+                      : inode_create (inode_sector, initial_size, false))
                   && dir_add (dir, name, inode_sector));
 
-  if (is_dir){
+  if (success && is_dir){
     struct dir *dir_new = dir_open (inode_open (inode_sector));
 
     ASSERT (dir_new != NULL);
-    ASSERT (dir_add (dir_new, ".", inode_sector));
     ASSERT (dir_add (dir_new, "..", dir_get_inode (dir) -> sector));
 
     dir_close (dir_new);
@@ -145,7 +149,7 @@ do_format (void)
 {
   printf ("Formatting file system...");
   free_map_create ();
-  if (!dir_create (ROOT_DIR_SECTOR, 16))
+  if (!dir_create (ROOT_DIR_SECTOR, 16, dir_use_index))
     PANIC ("root directory creation failed");
   free_map_close ();
   printf ("done.\n");
@@ -1,24 +1,64 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
+#include <stdint.h>
+#include <string.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
-static struct file *free_map_file;   /* Free map file. */
+/* Free map bits per sector of the free map file. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+
+static struct file *free_map_file;   /* Free map file, guarded by
+                                        free_map_flush_lock. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static disk_sector_t free_map_hint;  /* Where searches without a goal start. */
+
+/* Sectors of the free map file that differ from the disk.
+   Written back by free_map_flush(). */
+static struct bitmap *free_map_dirty;
+
+/* Protects the three above.  Never held across file I/O, since
+   the inode layer allocates while holding its own locks. */
+static struct lock free_map_lock;
+
+/* Serializes free_map_flush() against opening and closing the
+   free map file. */
+static struct lock free_map_flush_lock;
+
+static void mark_dirty (disk_sector_t, size_t);
 
 /* Initializes the free map. */
 void
 free_map_init (void) 
 {
+  lock_init (&free_map_lock);
+  lock_init (&free_map_flush_lock);
   free_map = bitmap_create (disk_size (filesys_disk));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--disk is too large");
+  free_map_dirty = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                                DISK_SECTOR_SIZE));
+  if (free_map_dirty == NULL)
+    PANIC ("bitmap creation failed--disk is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
 
+/* Marks the free map file sectors holding the bits of CNT sectors
+   starting at SECTOR as needing write-back. */
+static void
+mark_dirty (disk_sector_t sector, size_t cnt)
+{
+  size_t first = sector / BITS_PER_SECTOR;
+  size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+  bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
+
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if all sectors were
@@ -26,16 +66,39 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) 
 {
-  disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  return free_map_allocate_near (0, cnt, sectorp);
+}
+
+/* As free_map_allocate(), but looks for the run at or after GOAL
+   first, so a growing file can stay contiguous.  Without a GOAL
+   (0), or if nothing is free after it, the search starts from a
+   hint that rotates past each allocation, so unrelated files do
+   not interleave at the front of the disk, and last wraps to the
+   start of the disk. */
+bool
+free_map_allocate_near (disk_sector_t goal, size_t cnt,
+                        disk_sector_t *sectorp)
+{
+  disk_sector_t sector = BITMAP_ERROR;
+
+  lock_acquire (&free_map_lock);
+  if (goal != 0 && goal < bitmap_size (free_map))
+    sector = bitmap_scan (free_map, goal, cnt, false);
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, free_map_hint, cnt, false);
+  if (sector == BITMAP_ERROR)
+    sector = bitmap_scan (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      bitmap_set_multiple (free_map, sector, cnt, true);
+      mark_dirty (sector, cnt);
+      free_map_hint = sector + cnt;
+      if (free_map_hint >= bitmap_size (free_map))
+        free_map_hint = 0;
+      *sectorp = sector;
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
+  lock_release (&free_map_lock);
+
   return sector != BITMAP_ERROR;
 }
 
@@ -43,27 +106,84 @@ free_map_allocate (size_t cnt, disk_sector_t *sectorp)
 void
 free_map_release (disk_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  mark_dirty (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the dirty sectors of the free map back to the free map
+   file.  Each sector is copied out under the lock and written
+   after releasing it.  Does nothing until the free map is open. */
+void
+free_map_flush (void)
+{
+  static uint8_t buffer[DISK_SECTOR_SIZE];   /* Guarded by
+                                                free_map_flush_lock. */
+  off_t file_size;
+  size_t idx;
+
+  lock_acquire (&free_map_flush_lock);
+  file_size = bitmap_file_size (free_map);
+  while (free_map_file != NULL)
+    {
+      off_t ofs, size;
+      size_t bit, i;
+
+      lock_acquire (&free_map_lock);
+      idx = bitmap_scan_and_flip (free_map_dirty, 0, 1, true);
+      if (idx == BITMAP_ERROR)
+        {
+          lock_release (&free_map_lock);
+          break;
+        }
+
+      // pack the bits the same way bitmap_write() lays them out
+      ofs = idx * DISK_SECTOR_SIZE;
+      size = file_size - ofs < DISK_SECTOR_SIZE ? file_size - ofs
+                                                : DISK_SECTOR_SIZE;
+      memset (buffer, 0, sizeof buffer);
+      bit = idx * BITS_PER_SECTOR;
+      for (i = 0; i < BITS_PER_SECTOR && bit + i < bitmap_size (free_map); i++)
+        if (bitmap_test (free_map, bit + i))
+          buffer[i / 8] |= 1 << (i % 8);
+      lock_release (&free_map_lock);
+
+      if (file_write_at (free_map_file, buffer, size, ofs) != size)
+        {
+          lock_acquire (&free_map_lock);
+          bitmap_mark (free_map_dirty, idx);
+          lock_release (&free_map_lock);
+          break;
+        }
+    }
+  lock_release (&free_map_flush_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void) 
 {
+  lock_acquire (&free_map_flush_lock);
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (free_map_dirty, false);
+  lock_release (&free_map_flush_lock);
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) 
 {
+  free_map_flush ();
+  lock_acquire (&free_map_flush_lock);
   file_close (free_map_file);
+  free_map_file = NULL;
+  lock_release (&free_map_flush_lock);
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -76,9 +196,12 @@ free_map_create (void)
     PANIC ("free map creation failed");
 
   /* Write bitmap to file. */
+  lock_acquire (&free_map_flush_lock);
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (free_map_dirty, false);
+  lock_release (&free_map_flush_lock);
 }
@@ -1,4 +1,5 @@
 #include "filesys/inode.h"
+#include <hash.h>
 #include <list.h>
 #include <debug.h>
 #include <round.h>
@@ -8,25 +9,22 @@
 #include "filesys/cache.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
-/* Identifies an inode. */
+/* Identifies an inode, and which data layout it uses. */
 #define INODE_MAGIC 0x494e4f44
+#define INODE_EXTENT_MAGIC 0x494e4f45
 
-struct lock inode_lock;
+/* Layout of newly created inodes.  Chosen with -extents when
+   formatting, afterward taken from the free map inode. */
+bool inode_use_extents;
 
-bool lock_on (){
-  bool locked = false;
+/* Sectors prefetched past the end of a sequential read. */
+#define READ_AHEAD_SECTORS 8
 
-  if (lock_held_by_current_thread (&inode_lock))
-    locked = true;
-  else
-    lock_acquire (&inode_lock);
-}
-
-void lock_off (bool locked){
-  if (!locked)
-    lock_release (&inode_lock);
-}
+/* Extra sectors an extent inode allocates when a write grows it,
+   so that small appends extend one contiguous run. */
+#define PREALLOC_SECTORS 16
 
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
@@ -36,7 +34,40 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, DISK_SECTOR_SIZE);
 }
 
-bool disk_inode_build(struct inode_disk *, disk_sector_t);
+bool disk_inode_build(struct inode_disk *, disk_sector_t, disk_sector_t *);
+static bool disk_inode_grow (struct inode_disk *, size_t, size_t, size_t,
+                             disk_sector_t *);
+static void disk_inode_release (const struct inode_disk *);
+static bool extent_grow (struct inode_disk *, size_t, size_t,
+                         disk_sector_t *);
+static void read_ahead (struct inode *, off_t);
+
+static inline bool
+is_extent_inode (const struct inode_disk *disk_inode)
+{
+  return disk_inode->magic == INODE_EXTENT_MAGIC;
+}
+
+/* Returns the disk sector holding file sector IDX of extent
+   inode DISK_INODE, by binary search on the extent ends. */
+static disk_sector_t
+extent_to_sector (const struct inode_disk *disk_inode, uint32_t idx)
+{
+  size_t lo = 0, hi = disk_inode->extent_cnt;
+
+  while (lo < hi)
+    {
+      size_t mid = (lo + hi) / 2;
+      if (disk_inode->extents[mid].end <= idx)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  ASSERT (lo < disk_inode->extent_cnt);
+
+  uint32_t first = lo > 0 ? disk_inode->extents[lo - 1].end : 0;
+  return disk_inode->extents[lo].start + (idx - first);
+}
 
 /* Returns the disk sector that contains byte offset POS within
    INODE.
@@ -53,6 +84,9 @@ byte_to_sector (const struct inode *inode, off_t pos)
   struct inode_disk *disk_inode = &inode->data;
   int idx = pos / DISK_SECTOR_SIZE;
 
+  if (is_extent_inode (disk_inode))
+    return extent_to_sector (disk_inode, idx);
+
   // Direct block
   if (idx < DIRECT_BLOCK_NUM) {
     return disk_inode->direct_blocks[idx];
@@ -60,22 +94,22 @@ byte_to_sector (const struct inode *inode, off_t pos)
   // Indirect block
   else if (idx < DIRECT_BLOCK_NUM + 128) {
     idx -= DIRECT_BLOCK_NUM;
-    struct indirect_disk *disk_indirect = calloc(1, sizeof *disk_indirect);
-    cache_read(filesys_disk, disk_inode->indirect_block, disk_indirect);
+    struct indirect_disk *disk_indirect
+      = cache_get (filesys_disk, disk_inode->indirect_block, false);
     disk_sector_t result = disk_indirect->sectors[idx];
-    free(disk_indirect);
+    cache_put (disk_indirect, false);
     return result;
   }
   // Doubly indirect block
   else if (idx < DIRECT_BLOCK_NUM + 128 + 128*128) {
     idx -= DIRECT_BLOCK_NUM + 128;
-    struct indirect_disk *disk_indirect = calloc(1, sizeof *disk_indirect);
-    cache_read(filesys_disk, disk_inode->doubly_indirect_block, disk_indirect);
-    struct indirect_disk *disk_doubly_indirect = calloc(1, sizeof *disk_indirect);
-    cache_read(filesys_disk, disk_indirect->sectors[idx/128], disk_doubly_indirect);
-    disk_sector_t result = disk_doubly_indirect->sectors[idx%128];
-    free(disk_indirect);
-    free(disk_doubly_indirect);
+    struct indirect_disk *disk_indirect
+      = cache_get (filesys_disk, disk_inode->doubly_indirect_block, false);
+    disk_sector_t indirect_sector = disk_indirect->sectors[idx/128];
+    cache_put (disk_indirect, false);
+    disk_indirect = cache_get (filesys_disk, indirect_sector, false);
+    disk_sector_t result = disk_indirect->sectors[idx%128];
+    cache_put (disk_indirect, false);
     return result;
   }
   // File size over upper bound
@@ -84,16 +118,60 @@ byte_to_sector (const struct inode *inode, off_t pos)
   }
 }
 
-/* List of open inodes, so that opening a single inode twice
+/* Open inodes by sector, so that opening a single inode twice
    returns the same `struct inode'. */
-static struct list open_inodes;
+static struct hash open_inodes;
+
+/* Protects open_inodes and the open_cnt and removed members of
+   every open inode.  Never held across I/O. */
+static struct lock open_inodes_lock;
+
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, elem);
+  return hash_bytes (&inode->sector, sizeof inode->sector);
+}
+
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, elem)->sector
+          < hash_entry (b, struct inode, elem)->sector);
+}
+
+/* Returns the open inode for SECTOR, or a null pointer.
+   The caller must hold open_inodes_lock. */
+static struct inode *
+open_inode_find (disk_sector_t sector)
+{
+  struct inode key;
+  struct hash_elem *e;
+
+  key.sector = sector;
+  e = hash_find (&open_inodes, &key.elem);
+  return e != NULL ? hash_entry (e, struct inode, elem) : NULL;
+}
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  lock_init (&inode_lock);
-  list_init (&open_inodes);
+  lock_init (&open_inodes_lock);
+  hash_init (&open_inodes, inode_hash, inode_less, NULL);
+}
+
+/* Makes new inodes use the same data layout as the inode in
+   SECTOR, so that a disk keeps the layout it was formatted with. */
+void
+inode_adopt_layout (disk_sector_t sector)
+{
+  struct inode *inode = inode_open (sector);
+  if (inode == NULL)
+    PANIC ("can't read inode %"PRDSNu, sector);
+  inode_use_extents = is_extent_inode (&inode->data);
+  inode_close (inode);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -109,7 +187,6 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir)
 
   ASSERT (length >= 0);
 
-  bool locked = lock_on ();
   /* If this assertion fails, the inode structure is not exactly
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
@@ -118,105 +195,255 @@ inode_create (disk_sector_t sector, off_t length, bool is_dir)
   if (disk_inode != NULL)
     {
       disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
+      disk_inode->magic = inode_use_extents ? INODE_EXTENT_MAGIC : INODE_MAGIC;
       disk_inode->is_dir = is_dir;
 
-      success = true;
-
-      size_t sectors = bytes_to_sectors (length);
-      size_t i;
-      for (i=0; i<sectors; i++){
-        if (!disk_inode_build(disk_inode, i)){
-          success = false;
-          break;
-        }
-      }
-      // Save and free inode
+      /* Data goes right after the inode, if there is room. */
+      disk_sector_t goal = sector + 1;
+      success = disk_inode_grow (disk_inode, 0, bytes_to_sectors (length),
+                                 0, &goal);
+      // Save and free inode, or give back what was allocated
       if (success)
         cache_write(filesys_disk, sector, disk_inode);
+      else
+        disk_inode_release (disk_inode);
       free (disk_inode);
     }
   
-  lock_off (locked);
   return success;
 }
 
 
 
-bool disk_inode_build(struct inode_disk *disk_inode, disk_sector_t sector) {
-  ASSERT(disk_inode != NULL);
-
-  static char zeros[DISK_SECTOR_SIZE];
+/* Grows DISK_INODE from OLD_SECTORS to NEW_SECTORS data sectors,
+   each read back as zeros.  New sectors are allocated starting at
+   *GOAL, which is advanced past them.  An extent inode also
+   allocates up to PREALLOC more sectors that stay reserved beyond
+   its length.  Returns false if the disk is full or the file too
+   large. */
+static bool
+disk_inode_grow (struct inode_disk *disk_inode, size_t old_sectors,
+                 size_t new_sectors, size_t prealloc, disk_sector_t *goal)
+{
+  size_t i;
 
-  // Build direct blocks
-  if (sector < DIRECT_BLOCK_NUM) {
-    int idx = sector;
+  if (is_extent_inode (disk_inode))
+    {
+      if (!extent_grow (disk_inode, new_sectors, prealloc, goal))
+        return false;
+
+      /* Preallocated sectors are only zeroed once they are used. */
+      for (i = old_sectors; i < new_sectors; i++)
+        cache_put (cache_get_zeroed (filesys_disk,
+                                     extent_to_sector (disk_inode, i)), true);
+      return true;
+    }
 
-    if (free_map_allocate (1, &(disk_inode->direct_blocks[idx])))
-      cache_write (filesys_disk, disk_inode->direct_blocks[idx], zeros);
+  for (i = old_sectors; i < new_sectors; i++)
+    if (!disk_inode_build (disk_inode, i, goal))
+      return false;
+  return true;
+}
 
-    return true;
-  }
+/* Grows extent inode DISK_INODE to at least SECTORS allocated data
+   sectors, plus up to PREALLOC more.  The free map is asked for
+   the whole run first, near *GOAL or else right after the last
+   extent, and for smaller runs when the free space is fragmented.
+   A run that starts where the last extent ends is merged into it.
+   Returns false if the disk is full or the extent list overflows. */
+static bool
+extent_grow (struct inode_disk *disk_inode, size_t sectors, size_t prealloc,
+             disk_sector_t *goal)
+{
+  size_t cnt = disk_inode->extent_cnt;
+  uint32_t allocated = cnt > 0 ? disk_inode->extents[cnt - 1].end : 0;
 
-  // Build indirect blocks
-  else if (sector < DIRECT_BLOCK_NUM + 128) {
-    int idx = sector - DIRECT_BLOCK_NUM;
+  while (allocated < sectors)
+    {
+      size_t run = sectors + prealloc - allocated;
+      disk_sector_t start;
+
+      struct extent *last = cnt > 0 ? &disk_inode->extents[cnt - 1] : NULL;
+      uint32_t last_first = cnt > 1 ? disk_inode->extents[cnt - 2].end : 0;
+      disk_sector_t last_next = (last != NULL
+                                 ? last->start + (last->end - last_first)
+                                 : *goal);
+
+      while (!free_map_allocate_near (last_next, run, &start))
+        if ((run /= 2) == 0)
+          return false;
+
+      if (last != NULL && last_next == start)
+        last->end += run;
+      else if (cnt < EXTENT_NUM)
+        {
+          disk_inode->extents[cnt].start = start;
+          disk_inode->extents[cnt].end = allocated + run;
+          disk_inode->extent_cnt = ++cnt;
+        }
+      else
+        {
+          free_map_release (start, run);
+          return false;
+        }
 
-    struct indirect_disk *disk_indirect = calloc(1, sizeof *disk_indirect);
-    if (disk_inode->indirect_block == 0) {
-      free_map_allocate(1, &(disk_inode->indirect_block));
-      memcpy(disk_indirect, zeros, DISK_SECTOR_SIZE);
+      allocated += run;
+      *goal = start + run;
     }
-    else {
-      cache_read(filesys_disk, disk_inode->indirect_block, disk_indirect);
+  return true;
+}
+
+/* Frees the sectors listed in the indirect block at SECTOR, which
+   are indirect blocks themselves if LEVELS > 0, then the block.
+   Unused entries are 0.  The block is copied out first, so no cache
+   entry stays pinned across free map updates. */
+static void
+indirect_release (disk_sector_t sector, int levels)
+{
+  struct indirect_disk *disk_indirect;
+  size_t i;
+
+  if (sector == 0)
+    return;
+  disk_indirect = malloc (sizeof *disk_indirect);
+  if (disk_indirect == NULL)
+    return;
+  cache_read (filesys_disk, sector, disk_indirect);
+  for (i = 0; i < 128; i++)
+    if (disk_indirect->sectors[i] == 0)
+      continue;
+    else if (levels > 0)
+      indirect_release (disk_indirect->sectors[i], levels - 1);
+    else
+      free_map_release (disk_indirect->sectors[i], 1);
+  free (disk_indirect);
+  free_map_release (sector, 1);
+}
+
+/* Frees every sector DISK_INODE has allocated: its extents, or its
+   data sectors and indirect blocks.  Also used on a partly built
+   inode, whose unallocated entries are 0. */
+static void
+disk_inode_release (const struct inode_disk *disk_inode)
+{
+  size_t i;
+
+  if (is_extent_inode (disk_inode))
+    {
+      uint32_t first = 0;
+      for (i = 0; i < disk_inode->extent_cnt; i++)
+        {
+          free_map_release (disk_inode->extents[i].start,
+                            disk_inode->extents[i].end - first);
+          first = disk_inode->extents[i].end;
+        }
+      return;
     }
 
-    if (free_map_allocate(1, &(disk_indirect->sectors[idx])))
-      cache_write(filesys_disk, disk_indirect->sectors[idx], zeros);
+  for (i = 0; i < DIRECT_BLOCK_NUM; i++)
+    if (disk_inode->direct_blocks[i] != 0)
+      free_map_release (disk_inode->direct_blocks[i], 1);
+  indirect_release (disk_inode->indirect_block, 0);
+  indirect_release (disk_inode->doubly_indirect_block, 1);
+}
+
+/* Allocates a zeroed data sector at or after *GOAL, stores its
+   number in *SECTORP and advances *GOAL past it.
+   Returns false if the disk is full. */
+static bool
+allocate_zeroed (disk_sector_t *sectorp, disk_sector_t *goal)
+{
+  if (!free_map_allocate_near (*goal, 1, sectorp))
+    return false;
+  *goal = *sectorp + 1;
+  cache_put (cache_get_zeroed (filesys_disk, *sectorp), true);
+  return true;
+}
+
+/* Stores DATA_SECTOR at index IDX of the indirect block in
+   *INDIRECTP, first allocating the indirect block if *INDIRECTP
+   is 0.  Returns false if the disk is full. */
+static bool
+indirect_set (disk_sector_t *indirectp, int idx, disk_sector_t data_sector)
+{
+  struct indirect_disk *disk_indirect;
+
+  if (*indirectp == 0) {
+    if (!free_map_allocate (1, indirectp))
+      return false;
+    disk_indirect = cache_get_zeroed (filesys_disk, *indirectp);
+  }
+  else
+    disk_indirect = cache_get (filesys_disk, *indirectp, true);
+
+  disk_indirect->sectors[idx] = data_sector;
+  cache_put (disk_indirect, true);
+  return true;
+}
+
+/* Adds data sector number SECTOR to DISK_INODE, allocating it,
+   preferably at *GOAL, and any indirect blocks it needs.  Sectors
+   are allocated before an indirect block is pinned, so no cache
+   entry stays pinned across free map updates.  Returns false if
+   the disk is full or SECTOR is past the maximum file size. */
+bool disk_inode_build(struct inode_disk *disk_inode, disk_sector_t sector,
+                      disk_sector_t *goal) {
+  ASSERT(disk_inode != NULL);
 
-    cache_write(filesys_disk, disk_inode->indirect_block, disk_indirect);
-    free(disk_indirect);
+  disk_sector_t data_sector;
 
+  // Sector out of upper boundary
+  if (sector >= DIRECT_BLOCK_NUM + 128 + 128*128)
+    return false;
+
+  if (!allocate_zeroed (&data_sector, goal))
+    return false;
+
+  // Build direct blocks
+  if (sector < DIRECT_BLOCK_NUM) {
+    disk_inode->direct_blocks[sector] = data_sector;
     return true;
   }
 
+  bool success;
+
+  // Build indirect blocks
+  if (sector < DIRECT_BLOCK_NUM + 128) {
+    int idx = sector - DIRECT_BLOCK_NUM;
+
+    success = indirect_set (&disk_inode->indirect_block, idx, data_sector);
+  }
+
   // Build doubly indirect blocks
-  else if (sector < DIRECT_BLOCK_NUM + 128 + 128*128) {
+  else {
     int idx = sector - DIRECT_BLOCK_NUM - 128;
+    disk_sector_t indirect_sector = 0;
 
-    struct indirect_disk *disk_indirect = calloc(1, sizeof *disk_indirect);
-    if (disk_inode->doubly_indirect_block == 0) {
-      free_map_allocate(1, &(disk_inode->doubly_indirect_block));
-      memcpy(disk_indirect, zeros, DISK_SECTOR_SIZE);
-    }
-    else {
-      cache_read(filesys_disk, disk_inode->doubly_indirect_block, disk_indirect);
+    if (disk_inode->doubly_indirect_block != 0) {
+      struct indirect_disk *disk_indirect
+        = cache_get (filesys_disk, disk_inode->doubly_indirect_block, false);
+      indirect_sector = disk_indirect->sectors[idx/128];
+      cache_put (disk_indirect, false);
     }
 
-    struct indirect_disk *disk_doubly_indirect = calloc(1, sizeof *disk_doubly_indirect);
-    if (disk_indirect->sectors[idx/128] == 0) {
-      free_map_allocate(1, &(disk_indirect->sectors[idx/128]));
-      memcpy(disk_doubly_indirect, zeros, DISK_SECTOR_SIZE);
-    }
+    if (indirect_sector != 0)
+      success = indirect_set (&indirect_sector, idx%128, data_sector);
     else {
-      cache_read(filesys_disk, disk_indirect->sectors[idx/128], disk_doubly_indirect);
+      success = indirect_set (&indirect_sector, idx%128, data_sector);
+      // the new indirect block is not reachable if it cannot be
+      // linked into the doubly indirect block
+      if (success
+          && !indirect_set (&disk_inode->doubly_indirect_block, idx/128,
+                            indirect_sector)) {
+        free_map_release (indirect_sector, 1);
+        success = false;
+      }
     }
-
-    if (free_map_allocate(1, &(disk_doubly_indirect->sectors[idx%128])))
-      cache_write(filesys_disk, disk_doubly_indirect->sectors[idx%128], zeros);
-
-    cache_write(filesys_disk, disk_indirect->sectors[idx/128], disk_doubly_indirect);
-    free(disk_doubly_indirect);
-
-    cache_write(filesys_disk, disk_inode->doubly_indirect_block, disk_indirect);
-    free(disk_indirect);
-
-    return true;
   }
 
-  // Sector out of upper boundary
-  else
-    return false;
+  if (!success)
+    free_map_release (data_sector, 1);
+  return success;
 }
 
 
@@ -226,40 +453,54 @@ bool disk_inode_build(struct inode_disk *disk_inode, disk_sector_t sector) {
 struct inode *
 inode_open (disk_sector_t sector) 
 {
-  bool locked = lock_on ();
-
-  struct list_elem *e;
-  struct inode *inode;
+  struct inode *inode, *open;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&open_inodes_lock);
+  inode = open_inode_find (sector);
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          lock_off (locked);
-          return inode; 
-        }
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+      return inode;
     }
+  lock_release (&open_inodes_lock);
 
-  /* Allocate memory. */
+  /* Allocate memory and read the inode without holding the lock.
+     Whoever had the inode open last wrote it back already. */
   inode = malloc (sizeof *inode);
-  if (inode == NULL){
-    lock_off (locked);
+  if (inode == NULL)
     return NULL;
-  }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
+  inode->next_read_pos = 0;
+  inode->read_ahead_pos = 0;
+  rwlock_init (&inode->rwlock);
+  lock_init (&inode->lock);
+  lock_init (&inode->dir_lock);
   cache_read (filesys_disk, inode->sector, &inode->data);
-  
-  lock_off (locked);
+  inode->alloc_goal = (inode->data.length > 0
+                       ? byte_to_sector (inode, inode->data.length - 1) + 1
+                       : inode->sector + 1);
+
+  /* Somebody else may have opened it in the meantime. */
+  lock_acquire (&open_inodes_lock);
+  open = open_inode_find (sector);
+  if (open != NULL)
+    open->open_cnt++;
+  else
+    hash_insert (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  if (open != NULL)
+    {
+      free (inode);
+      return open;
+    }
   return inode;
 }
 
@@ -267,10 +508,12 @@ inode_open (disk_sector_t sector)
 struct inode *
 inode_reopen (struct inode *inode)
 {
-  bool locked = lock_on ();
   if (inode != NULL)
-    inode->open_cnt++;
-  lock_off (locked);
+    {
+      lock_acquire (&open_inodes_lock);
+      inode->open_cnt++;
+      lock_release (&open_inodes_lock);
+    }
   return inode;
 }
 
@@ -287,29 +530,33 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
-  bool locked = lock_on ();
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
-  /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  /* Remove from the table if this was the last opener. */
+  lock_acquire (&open_inodes_lock);
+  last = --inode->open_cnt == 0;
+  if (last)
+    hash_delete (&open_inodes, &inode->elem);
+  lock_release (&open_inodes_lock);
+
+  /* Release resources.  Nobody can find INODE any more, and the
+     sectors of a removed inode are not reused before they are
+     released here. */
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
           free_map_release (inode->sector, 1);
-          size_t i;
-          for (i=0; i<bytes_to_sectors(inode->data.length); i++)
-            free_map_release(byte_to_sector(inode, i*DISK_SECTOR_SIZE), 1);
+          disk_inode_release (&inode->data);
         }
 
       free (inode); 
     }
-  lock_off (locked);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -318,9 +565,9 @@ void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
-  bool locked = lock_on ();
+  lock_acquire (&open_inodes_lock);
   inode->removed = true;
-  lock_off (locked);
+  lock_release (&open_inodes_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -329,11 +576,10 @@ inode_remove (struct inode *inode)
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) 
 {
-  bool locked = lock_on ();
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rwlock);
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -350,62 +596,87 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
-        {
-          /* Read full sector directly into caller's buffer. */
-          cache_read (filesys_disk, sector_idx, buffer + bytes_read); 
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (DISK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          cache_read (filesys_disk, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy straight out of the cached sector. */
+      uint8_t *data = cache_get (filesys_disk, sector_idx, false);
+      memcpy (buffer + bytes_read, data + sector_ofs, chunk_size);
+      cache_put (data, false);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
-  lock_off (locked);
+  lock_acquire (&inode->lock);
+  if (offset - bytes_read == inode->next_read_pos)
+    read_ahead (inode, offset);
+  else
+    {
+      /* A seek: sectors queued before may have been evicted since,
+         so let the next sequential read queue them again. */
+      inode->read_ahead_pos = 0;
+    }
+  inode->next_read_pos = offset;
+  lock_release (&inode->lock);
+  rwlock_release_read (&inode->rwlock);
+
   return bytes_read;
 }
 
+/* Queues the READ_AHEAD_SECTORS sectors following byte offset POS
+   in INODE for asynchronous reading into the buffer cache, except
+   those already queued by an earlier call. */
+static void
+read_ahead (struct inode *inode, off_t pos)
+{
+  off_t start = ROUND_UP (pos, DISK_SECTOR_SIZE);
+  off_t end = start + READ_AHEAD_SECTORS * DISK_SECTOR_SIZE;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  if (start < inode->read_ahead_pos)
+    start = inode->read_ahead_pos;
+
+  for (; start < end; start += DISK_SECTOR_SIZE)
+    cache_read_ahead (filesys_disk, byte_to_sector (inode, start));
+
+  if (start > inode->read_ahead_pos)
+    inode->read_ahead_pos = start;
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
    less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   A write past end of file extends the inode.  It holds the inode
+   exclusively until its data is in place, so readers never see
+   the new length before the data.  Other writes share it. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
-  bool locked = lock_on ();
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool grow;
 
-  if (inode->deny_write_cnt)
+  lock_acquire (&inode->lock);
+  bool denied = inode->deny_write_cnt > 0;
+  lock_release (&inode->lock);
+  if (denied)
     return 0;
 
-  if (inode->data.length < offset+size) {
-    size_t i;
-    for (i = bytes_to_sectors(inode->data.length);
-         i < bytes_to_sectors(offset+size);
-         i++) {
-      disk_inode_build(&inode->data, i);
+  grow = inode_length (inode) < offset + size;
+  if (grow)
+    rwlock_acquire_write (&inode->rwlock);
+  else
+    rwlock_acquire_read (&inode->rwlock);
+
+  if (grow && inode->data.length < offset+size) {
+    if (disk_inode_grow (&inode->data, bytes_to_sectors (inode->data.length),
+                         bytes_to_sectors (offset+size), PREALLOC_SECTORS,
+                         &inode->alloc_goal)) {
+      inode->data.length = offset+size;
+      cache_write(filesys_disk, inode->sector, &inode->data);
     }
-    inode->data.length = offset+size;
-    cache_write(filesys_disk, inode->sector, &inode->data);
   }
 
   while (size > 0) 
@@ -424,52 +695,165 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) 
-        {
-          /* Write full sector directly to disk. */
-          cache_write (filesys_disk, sector_idx, buffer + bytes_written); 
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (DISK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            cache_read (filesys_disk, sector_idx, bounce);
-          else
-            memset (bounce, 0, DISK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          cache_write (filesys_disk, sector_idx, bounce); 
-        }
+      /* Copy straight into the cached sector.  A full sector
+         need not be read in first. */
+      uint8_t *data;
+      if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE)
+        data = cache_get_zeroed (filesys_disk, sector_idx);
+      else
+        data = cache_get (filesys_disk, sector_idx, true);
+      memcpy (data + sector_ofs, buffer + bytes_written, chunk_size);
+      cache_put (data, true);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
-  lock_off (locked);
+  if (grow)
+    rwlock_release_write (&inode->rwlock);
+  else
+    rwlock_release_read (&inode->rwlock);
   return bytes_written;
 }
 
+/* Reads SIZE bytes, at most a page, from INODE at sector-aligned
+   OFFSET into the page KPAGE, for mmap.  Sectors in the buffer
+   cache are copied from there; the others are read straight into
+   KPAGE, consecutive ones in one request, and are not cached, so
+   the data is not kept twice.  Whole sectors are read, so bytes
+   after SIZE may be overwritten.  Returns the number of bytes
+   read. */
+off_t
+inode_read_page (struct inode *inode, void *kpage, off_t size, off_t offset)
+{
+  uint8_t *buffer = kpage;
+  disk_sector_t run_start = 0;
+  size_t run_cnt = 0;
+  off_t pos;
+
+  ASSERT (offset % DISK_SECTOR_SIZE == 0);
+  ASSERT (size <= PGSIZE);
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (size > inode_length (inode) - offset)
+    size = inode_length (inode) > offset ? inode_length (inode) - offset : 0;
+
+  for (pos = 0; pos < size; pos += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector = byte_to_sector (inode, offset + pos);
+
+      if (run_cnt > 0 && sector == run_start + run_cnt)
+        {
+          run_cnt++;
+          continue;
+        }
+      if (run_cnt > 0)
+        disk_read_multi (filesys_disk, run_start,
+                         buffer + pos - run_cnt * DISK_SECTOR_SIZE, run_cnt);
+      run_cnt = 0;
+
+      if (!cache_read_cached (filesys_disk, sector, buffer + pos))
+        {
+          run_start = sector;
+          run_cnt = 1;
+        }
+    }
+  if (run_cnt > 0)
+    disk_read_multi (filesys_disk, run_start,
+                     buffer + pos - run_cnt * DISK_SECTOR_SIZE, run_cnt);
+  rwlock_release_read (&inode->rwlock);
+
+  return size;
+}
+
+/* Writes the sectors of a run that bypassed the cache, then
+   refreshes any copies that were cached while the write was
+   queued.  Those are not marked dirty, as the disk is current. */
+static void
+write_page_run (disk_sector_t start, const uint8_t *buffer, size_t cnt)
+{
+  size_t i;
+
+  disk_write_multi (filesys_disk, start, buffer, cnt);
+  for (i = 0; i < cnt; i++)
+    cache_write_cached (filesys_disk, start + i,
+                        buffer + i * DISK_SECTOR_SIZE, false);
+}
+
+/* Writes SIZE bytes, at most a page, from KPAGE to INODE at
+   sector-aligned OFFSET, for mmap.  Never extends INODE.  Whole
+   sectors in the buffer cache are updated there and the others are
+   written straight to disk without being cached; a final partial
+   sector goes through the cache, as in inode_write_at().  Returns
+   the number of bytes written. */
+off_t
+inode_write_page (struct inode *inode, const void *kpage, off_t size,
+                  off_t offset)
+{
+  const uint8_t *buffer = kpage;
+  disk_sector_t run_start = 0;
+  size_t run_cnt = 0;
+  off_t pos;
+
+  ASSERT (offset % DISK_SECTOR_SIZE == 0);
+  ASSERT (size <= PGSIZE);
+
+  lock_acquire (&inode->lock);
+  bool denied = inode->deny_write_cnt > 0;
+  lock_release (&inode->lock);
+  if (denied)
+    return 0;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (size > inode_length (inode) - offset)
+    size = inode_length (inode) > offset ? inode_length (inode) - offset : 0;
+
+  for (pos = 0; pos < size; pos += DISK_SECTOR_SIZE)
+    {
+      disk_sector_t sector = byte_to_sector (inode, offset + pos);
+
+      if (size - pos >= DISK_SECTOR_SIZE && run_cnt > 0
+          && sector == run_start + run_cnt)
+        {
+          run_cnt++;
+          continue;
+        }
+      if (run_cnt > 0)
+        write_page_run (run_start, buffer + pos - run_cnt * DISK_SECTOR_SIZE,
+                        run_cnt);
+      run_cnt = 0;
+
+      if (size - pos < DISK_SECTOR_SIZE)
+        {
+          uint8_t *data = cache_get (filesys_disk, sector, true);
+          memcpy (data, buffer + pos, size - pos);
+          cache_put (data, true);
+        }
+      else if (!cache_write_cached (filesys_disk, sector, buffer + pos, true))
+        {
+          run_start = sector;
+          run_cnt = 1;
+        }
+    }
+  if (run_cnt > 0)
+    write_page_run (run_start, buffer + pos - run_cnt * DISK_SECTOR_SIZE,
+                    run_cnt);
+  rwlock_release_read (&inode->rwlock);
+
+  return size;
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode) 
 {
-  bool locked = lock_on();
+  lock_acquire (&inode->lock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
-  lock_off (locked);
+  lock_release (&inode->lock);
 }
 
 /* Re-enables writes to INODE.
@@ -478,11 +862,24 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
-  bool locked = lock_on();
+  lock_acquire (&inode->lock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
-  lock_off (locked);
+  lock_release (&inode->lock);
+}
+
+/* Records that directory INODE is indexed by BUCKETS hash
+   buckets, one sector each. */
+void
+inode_set_dir_buckets (struct inode *inode, size_t buckets)
+{
+  ASSERT (inode->data.is_dir);
+  ASSERT (buckets <= UINT16_MAX);
+  rwlock_acquire_write (&inode->rwlock);
+  inode->data.dir_buckets = buckets;
+  cache_write (filesys_disk, inode->sector, &inode->data);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Returns the length, in bytes, of INODE's data. */
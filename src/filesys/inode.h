@@ -2,22 +2,51 @@
 #define FILESYS_INODE_H
 
 #include <stdbool.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/off_t.h"
 #include "devices/disk.h"
+#include "threads/synch.h"
 
 struct bitmap;
 
 #define DIRECT_BLOCK_NUM 123
+#define EXTENT_NUM 62
+
+/* A run of contiguous data sectors.  The run ends just before
+   file sector index END and starts where the previous extent of
+   the inode ended (or at 0). */
+struct extent
+  {
+    disk_sector_t start;                /* First disk sector of the run. */
+    uint32_t end;                       /* File sector index past the run. */
+  };
 
 /* On-disk inode.
-   Must be exactly DISK_SECTOR_SIZE bytes long. */
+   Must be exactly DISK_SECTOR_SIZE bytes long.
+   The magic number tells whether the data is mapped sector by
+   sector through block pointers or as a list of extents. */
 struct inode_disk
   {
-    disk_sector_t direct_blocks[DIRECT_BLOCK_NUM];
-    disk_sector_t indirect_block;
-    disk_sector_t doubly_indirect_block;
+    union
+      {
+        /* Block pointer layout (INODE_MAGIC). */
+        struct
+          {
+            disk_sector_t direct_blocks[DIRECT_BLOCK_NUM];
+            disk_sector_t indirect_block;
+            disk_sector_t doubly_indirect_block;
+          };
+        /* Extent layout (INODE_EXTENT_MAGIC). */
+        struct
+          {
+            uint32_t extent_cnt;
+            struct extent extents[EXTENT_NUM];
+          };
+      };
     bool is_dir;
+    uint16_t dir_buckets;               /* Hash buckets of an indexed
+                                           directory, 0 if linear. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
   };
@@ -29,15 +58,32 @@ struct indirect_disk {
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open inode table. */
     disk_sector_t sector;               /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    off_t next_read_pos;                /* End of the last read, to detect
+                                           sequential access. */
+    off_t read_ahead_pos;               /* End of data already queued for
+                                           read-ahead. */
+    disk_sector_t alloc_goal;           /* Where to look for the next data
+                                           sector when growing. */
+    struct rwlock rwlock;               /* Shared by reads and writes,
+                                           exclusive to grow or change
+                                           the disk inode. */
+    struct lock lock;                   /* Protects deny_write_cnt and the
+                                           read-ahead state. */
+    struct lock dir_lock;               /* Serializes updates of a
+                                           directory's entries. */
     struct inode_disk data;             /* Inode content. */
   };
 
+/* If true, inodes are created with the extent layout. */
+extern bool inode_use_extents;
+
 void inode_init (void);
+void inode_adopt_layout (disk_sector_t);
 bool inode_create (disk_sector_t, off_t, bool);
 struct inode *inode_open (disk_sector_t);
 struct inode *inode_reopen (struct inode *);
@@ -46,8 +92,12 @@ void inode_close (struct inode *);
 void inode_remove (struct inode *);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
+off_t inode_read_page (struct inode *, void *, off_t size, off_t offset);
+off_t inode_write_page (struct inode *, const void *, off_t size,
+                        off_t offset);
 void inode_deny_write (struct inode *);
 void inode_allow_write (struct inode *);
 off_t inode_length (const struct inode *);
+void inode_set_dir_buckets (struct inode *, size_t);
 
 #endif /* filesys/inode.h */
@@ -0,0 +1,54 @@
+/* Checks that after fork, writes by the child are not seen by the
+   parent and writes by the parent are not seen by the child, both
+   for data pages and for the stack. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (3 * 4096)
+
+static char buf[SIZE];
+
+static void
+check_buf (char c, const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != c)
+      fail ("%s: byte %zu is %02hhx, not %02hhx", who, i, buf[i], c);
+}
+
+void
+test_main (void)
+{
+  int local = 1;
+  pid_t pid;
+
+  memset (buf, 'a', sizeof buf);
+  pid = fork ();
+  if (pid == 0)
+    {
+      /* The parent writes after fork; the child must still see
+         the data from before. */
+      check_buf ('a', "child");
+      if (local != 1)
+        fail ("child: stack variable changed");
+      memset (buf, 'c', sizeof buf);
+      local = 3;
+      check_buf ('c', "child");
+      msg ("child: memory is private");
+      exit (0);
+    }
+
+  memset (buf, 'p', sizeof buf);
+  local = 2;
+  CHECK (pid > 0, "fork");
+  CHECK (wait (pid) == 0, "wait for child");
+  check_buf ('p', "parent");
+  if (local != 2)
+    fail ("parent: stack variable changed");
+  msg ("parent: memory is private");
+}
@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF', <<'EOF']);
+(fork-cow) begin
+(fork-cow) child: memory is private
+(fork-cow) fork
+(fork-cow) wait for child
+(fork-cow) parent: memory is private
+(fork-cow) end
+EOF
+(fork-cow) begin
+(fork-cow) fork
+(fork-cow) child: memory is private
+(fork-cow) wait for child
+(fork-cow) parent: memory is private
+(fork-cow) end
+EOF
+pass;
@@ -0,0 +1,41 @@
+/* Checks that a forked child inherits open files at the parent's
+   position, and that reads and close in the child do not affect
+   the parent's file. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define CHUNK 16
+
+void
+test_main (void)
+{
+  char data[CHUNK];
+  int handle;
+  pid_t pid;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (read (handle, data, CHUNK) == CHUNK, "read \"sample.txt\"");
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      if (read (handle, data, CHUNK) != CHUNK)
+        fail ("child: read failed");
+      if (memcmp (data, sample + CHUNK, CHUNK))
+        fail ("child: read bad data");
+      close (handle);
+      msg ("child: inherited file at parent's position");
+      exit (0);
+    }
+
+  CHECK (pid > 0, "fork");
+  CHECK (wait (pid) == 0, "wait for child");
+  CHECK (read (handle, data, CHUNK) == CHUNK, "read \"sample.txt\" again");
+  if (memcmp (data, sample + CHUNK, CHUNK))
+    fail ("parent: read bad data");
+  close (handle);
+}
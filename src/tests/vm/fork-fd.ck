@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF', <<'EOF']);
+(fork-fd) begin
+(fork-fd) open "sample.txt"
+(fork-fd) read "sample.txt"
+(fork-fd) child: inherited file at parent's position
+(fork-fd) fork
+(fork-fd) wait for child
+(fork-fd) read "sample.txt" again
+(fork-fd) end
+EOF
+(fork-fd) begin
+(fork-fd) open "sample.txt"
+(fork-fd) read "sample.txt"
+(fork-fd) fork
+(fork-fd) child: inherited file at parent's position
+(fork-fd) wait for child
+(fork-fd) read "sample.txt" again
+(fork-fd) end
+EOF
+pass;
@@ -0,0 +1,20 @@
+/* Forks a child and checks the value fork returns in each: 0 in
+   the child, the child's pid in the parent. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void)
+{
+  pid_t pid = fork ();
+
+  if (pid == 0)
+    {
+      msg ("child: fork returned 0");
+      exit (81);
+    }
+  CHECK (pid > 0, "parent: fork returned a pid");
+  CHECK (wait (pid) == 81, "wait for child");
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF', <<'EOF']);
+(fork-return) begin
+(fork-return) child: fork returned 0
+(fork-return) parent: fork returned a pid
+(fork-return) wait for child
+(fork-return) end
+EOF
+(fork-return) begin
+(fork-return) parent: fork returned a pid
+(fork-return) child: fork returned 0
+(fork-return) wait for child
+(fork-return) end
+EOF
+pass;
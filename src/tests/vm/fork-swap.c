@@ -0,0 +1,59 @@
+/* Fills 1 MB, forks, and has the child touch another 2 MB so that
+   frames still shared with the parent are evicted to swap.  Both
+   processes then check that they still see the original data, and
+   the child rewrites it in place to force copies of the pages it
+   swapped back in. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define SIZE (1024 * 1024)
+#define PRESSURE (2 * 1024 * 1024)
+
+static char buf[SIZE];
+static char pressure[PRESSURE];
+
+static void
+check_buf (const char *who)
+{
+  size_t i;
+
+  for (i = 0; i < SIZE; i++)
+    if (buf[i] != (char) (i % 251))
+      fail ("%s: byte %zu != %zu", who, i, i % 251);
+}
+
+void
+test_main (void)
+{
+  struct arc4 arc4;
+  size_t i;
+  pid_t pid;
+
+  for (i = 0; i < SIZE; i++)
+    buf[i] = i % 251;
+
+  pid = fork ();
+  if (pid == 0)
+    {
+      memset (pressure, 0x5a, sizeof pressure);
+      check_buf ("child");
+
+      /* Encrypt and decrypt in place, so each page is copied. */
+      arc4_init (&arc4, "foobar", 6);
+      arc4_crypt (&arc4, buf, SIZE);
+      arc4_init (&arc4, "foobar", 6);
+      arc4_crypt (&arc4, buf, SIZE);
+      check_buf ("child");
+      msg ("child: data intact");
+      exit (0x42);
+    }
+
+  CHECK (pid > 0, "fork");
+  CHECK (wait (pid) == 0x42, "wait for child");
+  check_buf ("parent");
+  msg ("parent: data intact");
+}
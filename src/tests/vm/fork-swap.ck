@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF', <<'EOF']);
+(fork-swap) begin
+(fork-swap) child: data intact
+(fork-swap) fork
+(fork-swap) wait for child
+(fork-swap) parent: data intact
+(fork-swap) end
+EOF
+(fork-swap) begin
+(fork-swap) fork
+(fork-swap) child: data intact
+(fork-swap) wait for child
+(fork-swap) parent: data intact
+(fork-swap) end
+EOF
+pass;
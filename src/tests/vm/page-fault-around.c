@@ -0,0 +1,29 @@
+/* Reads one byte from each page of a 32-page read-only array, which
+   lies in the executable's text segment.  Fault-around should map
+   the following pages of the segment on each fault, so the whole run
+   takes fewer page faults than the array has pages; the .ck file
+   checks the count the kernel prints at shutdown. */
+
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGES 32
+#define SIZE (PAGES * 4096)
+
+/* Initialized, so all of it is stored in the executable rather than
+   left to zero-only pages. */
+static const char data[SIZE] = { 1 };
+
+void
+test_main (void)
+{
+  volatile const char *p = data;
+  size_t i;
+  int sum = 0;
+
+  for (i = 0; i < SIZE; i += 4096)
+    sum += p[i] + p[i + 4095];
+  if (sum != 1)
+    fail ("sum is %d, not 1", sum);
+  msg ("read %d pages", PAGES);
+}
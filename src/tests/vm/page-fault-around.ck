@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(page-fault-around) begin
+(page-fault-around) read 32 pages
+(page-fault-around) end
+EOF
+
+# Without fault-around, touching the array alone takes 32 faults.
+our ($test);
+my (@output) = read_text_file ("$test.output");
+my ($faults) = map (/^Exception: (\d+) page faults$/, @output);
+fail "missing page fault count\n" if !defined $faults;
+fail "$faults page faults: neighbouring pages were not mapped\n"
+  if $faults >= 32;
+pass;
@@ -34,9 +34,13 @@
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #include "filesys/cache.h"
+#include "filesys/directory.h"
+#include "filesys/inode.h"
 #endif
 #ifdef VM
 #include "vm/frame.h"
+#include "vm/page.h"
+#include "vm/swap.h"
 #endif
 
 /* Amount of physical memory, in 4 kB pages. */
@@ -111,6 +115,7 @@ main (void)
 
 #ifdef VM
   frame_init();
+  page_zero_init();
 #endif
 
   /* Start thread scheduler and enable interrupts. */
@@ -253,6 +258,20 @@ parse_options (char **argv)
 #ifdef FILESYS
       else if (!strcmp (name, "-f"))
         format_filesys = true;
+      else if (!strcmp (name, "-extents"))
+        inode_use_extents = true;
+      else if (!strcmp (name, "-dirhash"))
+        dir_use_index = true;
+      else if (!strcmp (name, "-cache-policy"))
+        {
+          if (value == NULL || !cache_set_policy (value))
+            PANIC ("unknown cache policy `%s' (use -h for help)", value);
+        }
+      else if (!strcmp (name, "-cache-size"))
+        {
+          if (value == NULL || !cache_set_size (atoi (value)))
+            PANIC ("cache size must be at least %d sectors", CACHE_MIN_SIZE);
+        }
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
@@ -361,6 +380,12 @@ usage (void)
           "  -h                 Print this help message and power off.\n"
           "  -q                 Power off VM after actions or on panic.\n"
           "  -f                 Format file system disk during startup.\n"
+#ifdef FILESYS
+          "  -extents           With -f, lay out files as extents.\n"
+          "  -dirhash           Create new directories with a hash index.\n"
+          "  -cache-policy=POLICY  Buffer cache eviction: fifo, lru or clock.\n"
+          "  -cache-size=SECTORS   Number of buffer cache entries.\n"
+#endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
@@ -403,10 +428,14 @@ print_stats (void)
   thread_print_stats ();
 #ifdef FILESYS
   disk_print_stats ();
+  cache_print_stats ();
 #endif
   console_print_stats ();
   kbd_print_stats ();
 #ifdef USERPROG
   exception_print_stats ();
 #endif
+#ifdef VM
+  swap_print_stats ();
+#endif
 }
@@ -6,6 +6,10 @@
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#ifdef VM
+#include "vm/page.h"
+#include "vm/vma.h"
+#endif
 
 /* Number of page faults processed. */
 static long long page_fault_cnt;
@@ -155,8 +159,12 @@ page_fault (struct intr_frame *f)
   user = (f->error_code & PF_U) != 0;
 
 #ifdef VM
-  if (!not_present)
+  if (!not_present){
+    // zero frame, or copy-on-write page shared since fork
+    if (write && is_user_vaddr(fault_addr) && page_write_fault(fault_addr))
+      return;
     exit(-1);
+  }
   if (!is_user_vaddr(fault_addr))
     exit(-1);
 
@@ -169,11 +177,11 @@ page_fault (struct intr_frame *f)
   bool sg_1 = (fault_addr >= esp) && (fault_addr < PHYS_BASE);
   bool sg_2 = fault_addr == f->esp-4;
   bool sg_3 = fault_addr == f->esp-32;
-  bool sg_bad = (fault_addr < PHYS_BASE - 0x800000) || (fault_addr >= PHYS_BASE);
+  bool sg_bad = (fault_addr < PHYS_BASE - STACK_MAX) || (fault_addr >= PHYS_BASE);
   if (!sg_bad && (sg_1 || sg_2 || sg_3))
-    page_add_stack(fault_addr);
+    vma_grow_stack(fault_addr);
 
-  if (page_load(fault_addr))
+  if (page_load(fault_addr, write))
     return;
 #endif
 
@@ -14,6 +14,7 @@
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
@@ -22,6 +23,7 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 #include "vm/swap.h"
+#include "vm/vma.h"
 #endif
 
 static thread_func start_process NO_RETURN;
@@ -49,7 +51,11 @@ void process_sema_init (struct process_sema *process_sema){
   list_init(&process_sema->file_desc_list);
 #ifdef VM
   page_init(&process_sema->page_hash);
+  process_sema->vmas = NULL;
+  process_sema->vma_cnt = process_sema->vma_cap = 0;
   list_init(&process_sema->mmap_list);
+  process_sema->fault_next = NULL;
+  process_sema->fault_window = FAULT_AROUND_INIT;
 #endif
 }
 
@@ -238,6 +244,150 @@ start_process (void *process_sema_)
   NOT_REACHED ();
 }
 
+#ifdef VM
+/* Handed from process_fork() to fork_process(). */
+struct fork_args
+  {
+    struct process_sema *process_sema;  /* The child's. */
+    struct thread *parent;
+    struct intr_frame if_;              /* Parent's system call frame. */
+    struct semaphore done;              /* Up'd once the child is set up. */
+    bool success;
+  };
+
+static thread_func fork_process NO_RETURN;
+static bool fork_files (struct process_sema *, struct process_sema *);
+
+/* Starts a child of the current process that continues from its
+   system call frame F, where it returns 0.  The address space is
+   shared copy-on-write, open files are reopened at the same
+   positions, and memory mappings are not inherited.  Returns the
+   child's thread id, or TID_ERROR if it could not be created. */
+tid_t
+process_fork (struct intr_frame *f)
+{
+  struct fork_args args;
+  tid_t tid;
+
+  lock_acquire (&process_lock);
+  args.process_sema = malloc (sizeof (struct process_sema));
+  if (args.process_sema == NULL)
+    {
+      lock_release (&process_lock);
+      return TID_ERROR;
+    }
+  process_sema_init (args.process_sema);
+  args.process_sema->parent_pid = thread_current ()->tid;
+  args.process_sema->dir = dir_reopen (current_process_sema ()->dir);
+  args.process_sema->cmd_line = NULL;
+  args.process_sema->executable_file = NULL;
+  lock_release (&process_lock);
+
+  args.parent = thread_current ();
+  args.if_ = *f;
+  sema_init (&args.done, 0);
+  args.success = false;
+
+  tid = thread_create (thread_current ()->name, PRI_DEFAULT, fork_process,
+                       &args);
+  if (tid == TID_ERROR)
+    {
+      dir_close (args.process_sema->dir);
+      free (args.process_sema);
+      return TID_ERROR;
+    }
+
+  sema_down (&args.done);
+  return args.success ? tid : TID_ERROR;
+}
+
+/* A thread function that makes the new thread a copy of the
+   process that forked it and returns to user mode from that
+   process's system call. */
+static void
+fork_process (void *args_)
+{
+  struct fork_args *args = args_;
+  struct process_sema *process_sema = args->process_sema;
+  struct process_sema *parent_sema = args->parent->process_sema;
+  struct thread *cur = thread_current ();
+  struct intr_frame if_ = args->if_;
+  bool success;
+
+  lock_acquire (&process_lock);
+  process_sema->pid = cur->tid;
+  cur->process_sema = process_sema;
+  list_push_back (&process_sema_list, &process_sema->elem);
+
+  cur->pagedir = pagedir_create ();
+  success = cur->pagedir != NULL;
+  if (success)
+    {
+      process_activate ();
+      process_sema->executable_file
+        = file_reopen (parent_sema->executable_file);
+      success = (process_sema->executable_file != NULL
+                 && fork_files (parent_sema, process_sema));
+    }
+  if (success)
+    {
+      file_deny_write (process_sema->executable_file);
+      success = vma_fork (parent_sema, process_sema,
+                          process_sema->executable_file);
+    }
+  if (success)
+    {
+      lock_acquire (&lock_frame);
+      lock_acquire (&swap_lock);
+      success = page_fork (args->parent, process_sema->executable_file);
+      lock_release (&swap_lock);
+      lock_release (&lock_frame);
+    }
+
+  /* ARGS lives on the parent's stack, which it may leave now. */
+  args->success = success;
+  if (!success)
+    process_sema->load_success = -1;
+  sema_up (&args->done);
+  lock_release (&process_lock);
+  if (!success)
+    thread_exit ();
+
+  if_.eax = 0;
+  asm volatile ("movl %0, %%esp; jmp intr_exit" : : "g" (&if_) : "memory");
+  NOT_REACHED ();
+}
+
+/* Gives CHILD its own handle on every file PARENT has open, under
+   the same descriptor and at the same position. */
+static bool
+fork_files (struct process_sema *parent, struct process_sema *child)
+{
+  struct list_elem *e;
+
+  for (e = list_begin (&parent->file_desc_list);
+       e != list_end (&parent->file_desc_list); e = list_next (e))
+    {
+      struct file_desc *desc = list_entry (e, struct file_desc, elem);
+      struct file_desc *copy = malloc (sizeof *copy);
+
+      if (copy == NULL)
+        return false;
+      copy->file = file_reopen (desc->file);
+      if (copy->file == NULL)
+        {
+          free (copy);
+          return false;
+        }
+      file_seek (copy->file, file_tell (desc->file));
+      copy->fd = desc->fd;
+      strlcpy (copy->name, desc->name, sizeof copy->name);
+      list_push_back (&child->file_desc_list, &copy->elem);
+    }
+  return true;
+}
+#endif
+
 /* Waits for thread TID to die and returns its exit status.  If
    it was terminated by the kernel (i.e. killed due to an
    exception), returns -1.  If TID is invalid or if it was not a
@@ -318,8 +468,10 @@ process_exit (void)
   enum intr_level old_level = intr_disable();
 
 #ifdef VM
-  if (process_sema != NULL)
+  if (process_sema != NULL){
     page_destroy(&process_sema->page_hash);
+    vma_destroy(process_sema);
+  }
 #endif
 
   uint32_t *pd;
@@ -626,6 +778,10 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
   ASSERT (pg_ofs (upage) == 0);
   ASSERT (ofs % PGSIZE == 0);
 
+#ifdef VM
+  /* Pages are created from the region when first faulted in. */
+  return vma_add_file (file, ofs, upage, read_bytes, zero_bytes, writable);
+#else
   file_seek (file, ofs);
   while (read_bytes > 0 || zero_bytes > 0) 
     {
@@ -635,9 +791,6 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
       size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
       size_t page_zero_bytes = PGSIZE - page_read_bytes;
 
-#ifdef VM
-      page_add_file(file, ofs, upage, page_read_bytes, page_zero_bytes, writable);
-#else
       /* Get a page of memory. */
       uint8_t *kpage = palloc_get_page (PAL_USER);
       if(kpage == NULL){
@@ -658,17 +811,14 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
           palloc_free_page (kpage);
           return false; 
         }
-#endif
 
       /* Advance. */
       read_bytes -= page_read_bytes;
       zero_bytes -= page_zero_bytes;
       upage += PGSIZE;
-#ifdef VM
-      ofs += PGSIZE;
-#endif
     }
   return true;
+#endif
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
@@ -681,8 +831,7 @@ setup_stack (void **esp)
 
   upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
 #ifdef VM
-  page_add_stack(upage);
-  success = true;
+  success = vma_grow_stack(upage);
   *esp = PHYS_BASE;
   thread_current()->esp = PHYS_BASE;
 #else
@@ -13,6 +13,11 @@ tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (void);
+#ifdef VM
+struct intr_frame;
+struct vma;
+tid_t process_fork (struct intr_frame *);
+#endif
 void set_exit_status (int);
 struct process_sema *pid_to_process_sema(int);
 bool install_page (void *upage, void *kpage, bool writable);
@@ -33,8 +38,13 @@ struct process_sema
 
   struct dir *dir;
 #ifdef VM
-  struct hash page_hash;
+  struct hash page_hash;    // pages touched so far
+  struct vma **vmas;        // regions, sorted by address
+  size_t vma_cnt;           // regions in VMAS
+  size_t vma_cap;           // slots allocated in VMAS
   struct list mmap_list;
+  uint8_t *fault_next;     // page a sequential access faults on next
+  unsigned fault_window;   // pages mapped per file-backed fault
 #endif
 };
 
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 
@@ -13,6 +14,7 @@
 
 #ifdef VM
 #include "vm/page.h"
+#include "vm/vma.h"
 #endif
 
 #define READDIR_MAX_LEN 14
@@ -38,11 +40,13 @@ bool mkdir (char *);
 bool readdir (int, char *);
 bool isdir (int);
 int inumber (int);
+#ifdef VM
+pid_t sys_fork (struct intr_frame *);
+#endif
 
 int file_desc_idx=2;
 int mmap_idx=1;
 struct lock fork_lock;
-struct lock file_lock;
 
 
 //Read a byte at user virtual address UADDR
@@ -124,7 +128,6 @@ void
 syscall_init (void) 
 {
   lock_init(&fork_lock);
-  lock_init(&file_lock);
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
 }
 
@@ -206,6 +209,11 @@ syscall_handler (struct intr_frame *f UNUSED)
     case SYS_INUMBER:
       f->eax = inumber (get_user ((int *)(f->esp)+1));
       break;
+#ifdef VM
+    case SYS_FORK:
+      f->eax = sys_fork (f);
+      break;
+#endif
   }
 }
 
@@ -235,6 +243,17 @@ pid_t exec (const char *cmd_line) {
 
 
 
+#ifdef VM
+pid_t sys_fork (struct intr_frame *f) {
+  lock_acquire(&fork_lock);
+  int pid = process_fork (f);
+  lock_release(&fork_lock);
+  return pid;
+}
+#endif
+
+
+
 int wait (pid_t pid) {
   return process_wait (pid);
 }
@@ -245,18 +264,14 @@ bool create (const char *file, unsigned initial_size) {
   if (file == NULL)
     exit(-1);
 
-  lock_acquire(&file_lock);
   bool result = filesys_create(file, initial_size, false);
-  lock_release(&file_lock);
   return result;
 }
 
 
 
 bool remove (const char *file) {
-  lock_acquire(&file_lock);
   bool result = filesys_remove(file);
-  lock_release(&file_lock);
   return result;
 }
 
@@ -266,9 +281,7 @@ int open (const char *file) {
   if (file == NULL)
     exit(-1);
 
-  lock_acquire(&file_lock);
   struct file *res_file = filesys_open(file);
-  lock_release(&file_lock);
   if (res_file == NULL)
     return -1;
 
@@ -289,9 +302,7 @@ int open (const char *file) {
 int filesize (int fd) {
   struct file_desc *target = get_file_desc(fd);
 
-  lock_acquire(&file_lock);
   int result = file_length(target->file);
-  lock_release(&file_lock);
   return result;
 }
 
@@ -304,15 +315,16 @@ int read (int fd, void *buffer, unsigned size) {
 
   struct file_desc *target = get_file_desc(fd);
 
-  lock_acquire(&file_lock);
-/*#ifdef VM
-  page_set_pin (buffer, size, true);
-#endif*/
+#ifdef VM
+  // the file system holds its locks while copying into BUFFER, so
+  // BUFFER must not fault then
+  if (!page_pin_buffer (buffer, size, true))
+    exit (-1);
+#endif
   int result = file_read(target->file, buffer, size);
-/*#ifdef VM
-  page_set_pin (buffer, size, false);
-#endif*/
-  lock_release(&file_lock);
+#ifdef VM
+  page_unpin_buffer (buffer, size);
+#endif
   return result;
 }
 
@@ -327,15 +339,14 @@ int write (int fd, const void *buffer, unsigned size) {
 
   struct file_desc *target = get_file_desc(fd);
 
-  lock_acquire(&file_lock);
-/*#ifdef VM
-  page_set_pin (buffer, size, true);
-#endif*/
+#ifdef VM
+  if (!page_pin_buffer (buffer, size, false))
+    exit (-1);
+#endif
   int result = file_write(target->file, buffer, size);
-/*#ifdef VM
-  page_set_pin (buffer, size, false);
-#endif*/
-  lock_release(&file_lock);
+#ifdef VM
+  page_unpin_buffer (buffer, size);
+#endif
   return result;
 }
 
@@ -344,9 +355,7 @@ int write (int fd, const void *buffer, unsigned size) {
 void seek (int fd, unsigned position) {
   struct file_desc *target = get_file_desc(fd);
 
-  lock_acquire(&file_lock);
   file_seek(target->file, position);
-  lock_release(&file_lock);
 }
 
 
@@ -354,9 +363,7 @@ void seek (int fd, unsigned position) {
 unsigned tell (int fd) {
   struct file_desc *target = get_file_desc(fd);
 
-  lock_acquire(&file_lock);
   unsigned result = file_tell(target->file);
-  lock_release(&file_lock);
   return result;
 }
 
@@ -370,9 +377,7 @@ void close (int fd) {
   if(target == NULL)
     return;
 
-  lock_acquire(&file_lock);
   file_close(target->file);
-  lock_release(&file_lock);
   list_remove(&(target->elem));
   free(target);
 }
@@ -398,26 +403,10 @@ int mmap (int fd, void *addr) {
   mte->base = addr;
   mte->length = size;
 
-  int page_read_bytes, page_zero_bytes;
-  void *upage;
-
-  for (upage=addr; upage<addr+size; upage+=PGSIZE){
-    if (upage+PGSIZE < addr+size){
-      page_read_bytes = PGSIZE;
-      page_zero_bytes = 0;
-    }
-    else{
-      page_read_bytes = addr + size - upage;
-      page_zero_bytes = PGSIZE - page_read_bytes;
-    }
-    if (!page_add_mmap (mte, upage-addr, upage,
-        page_read_bytes, page_zero_bytes, true)){
-      void *i;
-      for (i=addr; i<upage; i+=PGSIZE){
-        page_free_mmap (i);
-      }
-      return -1;
-    }
+  if (!vma_add_mmap (mte)){
+    file_close (mte->file);
+    free (mte);
+    return -1;
   }
 
   list_push_back (&current_process_sema()->mmap_list, &mte->elem);
@@ -439,11 +428,7 @@ void munmap (int map_id) {
   }
   ASSERT (mte->map_id == map_id);
 
-  void *upage;
-
-  for (upage=mte->base; upage<(mte->base)+(mte->length); upage+=PGSIZE){
-    page_free_mmap (upage);
-  }
+  vma_unmap (mte);
 
   file_close(mte->file);
 
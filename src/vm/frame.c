@@ -1,20 +1,35 @@
 #include "vm/frame.h"
 #include <stdio.h>
+#include <string.h>
 #include "lib/kernel/hash.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
+#include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "vm/page.h"
 #include "vm/swap.h"
 
 struct list FIFO_list;
 struct hash frame_table;
+static struct hash share_table;   // shared frames by (sector, ofs)
+
+/* Clock hand of choose_frame_evict(), an element of FIFO_list or
+   its end.  Persists between evictions. */
+static struct list_elem *clock_hand;
 
 unsigned frame_hash_func (const struct hash_elem *, void *);
 bool frame_less_func (const struct hash_elem *, const struct hash_elem *, void * UNUSED);
 struct frame_table_entry *get_frame(void *);
+static bool frame_evictable (struct frame_table_entry *);
+static bool frame_accessed (struct frame_table_entry *, bool);
+static uint8_t *frame_get (enum palloc_flags);
+static void frame_insert (void *, void *, bool);
+static unsigned share_hash_func (const struct hash_elem *, void *);
+static bool share_less_func (const struct hash_elem *, const struct hash_elem *, void *);
 
 
 unsigned
@@ -51,34 +66,322 @@ struct frame_table_entry *get_frame(void *kpage) {
 void frame_init(){
   lock_init (&lock_frame);
   list_init (&FIFO_list);
+  clock_hand = list_end (&FIFO_list);
   hash_init (&frame_table, frame_hash_func, frame_less_func, NULL);
+  hash_init (&share_table, share_hash_func, share_less_func, NULL);
 }
 
-struct frame_table_entry *choose_frame_evict() {
-  struct list_elem *e;
+static unsigned
+share_hash_func (const struct hash_elem *e, void *aux UNUSED){
+  const struct frame_table_entry *fte =
+          hash_entry (e, struct frame_table_entry, elem_share);
+
+  return (hash_int (fte->sector) ^ hash_int (fte->ofs)
+          ^ hash_int (fte->read_bytes));
+}
+
+static bool
+share_less_func (const struct hash_elem *a_, const struct hash_elem *b_, void *aux UNUSED){
+  const struct frame_table_entry *a =
+          hash_entry (a_, struct frame_table_entry, elem_share);
+  const struct frame_table_entry *b =
+          hash_entry (b_, struct frame_table_entry, elem_share);
+
+  if (a->sector != b->sector)
+    return a->sector < b->sector;
+  if (a->ofs != b->ofs)
+    return a->ofs < b->ofs;
+  return a->read_bytes < b->read_bytes;
+}
+
+// find the shared frame holding PAGE's contents
+static struct frame_table_entry *share_find (struct page *page){
+  struct frame_table_entry dummy;
+  struct hash_elem *e;
+
+  dummy.sector = inode_get_inumber (file_get_inode (page->file));
+  dummy.ofs = page->ofs;
+  dummy.read_bytes = page->page_read_bytes;
+  e = hash_find (&share_table, &dummy.elem_share);
+  return e != NULL ? hash_entry (e, struct frame_table_entry, elem_share) : NULL;
+}
+
+//map read-only file PAGE of the current process to the frame that
+//another process already loaded it into, if any
+bool frame_share (struct page *page){
+  struct frame_table_entry *fte;
+  struct frame_sharer *sharer;
+  bool success = false;
+
+  lock_acquire(&lock_frame);
+  fte = share_find (page);
+  if (fte != NULL && (sharer = malloc (sizeof *sharer)) != NULL){
+    if (install_page (page->upage, fte->kpage, false)){
+      sharer->thread = thread_current ();
+      sharer->upage = page->upage;
+      list_push_back (&fte->sharers, &sharer->elem);
+      // set under lock_frame so eviction sees the mapping
+      page->kpage = fte->kpage;
+      page->type = PAGE_LOADED;
+      success = true;
+    }
+    else
+      free (sharer);
+  }
+  lock_release(&lock_frame);
+  return success;
+}
+
+//offer KPAGE, just loaded with read-only file PAGE, for sharing
+void frame_share_add (void *kpage, struct page *page){
   struct frame_table_entry *fte;
-  struct hash *page_hash;
-  struct page *page;
 
-  for (e=list_begin(&FIFO_list); e!=list_end(&FIFO_list); e=list_next(e)){
-    fte = list_entry (e, struct frame_table_entry, elem_list);
+  lock_acquire(&lock_frame);
+  fte = get_frame (kpage);
+  // it may have been evicted already, or another process may have
+  // loaded the same page in the meantime
+  if (fte != NULL && !fte->shared && share_find (page) == NULL){
+    fte->shared = true;
+    fte->sector = inode_get_inumber (file_get_inode (page->file));
+    fte->ofs = page->ofs;
+    fte->read_bytes = page->page_read_bytes;
+    hash_insert (&share_table, &fte->elem_share);
+  }
+  lock_release(&lock_frame);
+}
+
+//make FTE not present to every mapper before it is evicted, so no
+//store can land after its dirty bits are read.  The dirty bits
+//themselves are kept
+void frame_unmap (struct frame_table_entry *fte){
+  struct list_elem *e;
 
-    page_hash = &(((fte->thread)->process_sema)->page_hash);
-    ASSERT(page_hash != NULL)
+  ASSERT (lock_held_by_current_thread (&lock_frame));
 
-    page = get_page (page_hash, fte->upage);
-    if(page->type == PAGE_LOADED || page->type == PAGE_MMAP)
-      return fte;
+  pagedir_clear_page (fte->thread->pagedir, fte->upage);
+  for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers);
+       e = list_next (e)){
+    struct frame_sharer *sharer = list_entry (e, struct frame_sharer, elem);
+    pagedir_clear_page (sharer->thread->pagedir, sharer->upage);
   }
-  ASSERT (false);
 }
 
-uint8_t *frame_allocate (void *upage, bool writable, enum palloc_flags flags){
-#ifdef DEBUG
-  printf("frame_allocate in upage %p %s\n",upage,thread_current()->name);
-#endif
+//unmap every mapper of FTE but fte->thread, for eviction.  Their
+//pages go back to their file, or to swap SLOT unless it is negative
+void frame_unmap_sharers (struct frame_table_entry *fte, int slot){
+  ASSERT (lock_held_by_current_thread (&lock_frame));
+
+  while (!list_empty (&fte->sharers)){
+    struct frame_sharer *sharer = list_entry (list_pop_front (&fte->sharers),
+                                              struct frame_sharer, elem);
+    struct page *page = get_page (&sharer->thread->process_sema->page_hash,
+                                  sharer->upage);
+
+    if (slot < 0)
+      page->type = page_file_type (page);
+    else{
+      swap_dup (slot);
+      page->type = PAGE_SWAP;
+      page->slot = slot;
+      page->file_backed = false;
+    }
+    page->kpage = NULL;
+    page->cow = false;
+    pagedir_clear_page (sharer->thread->pagedir, sharer->upage);
+    free (sharer);
+  }
+}
+
+//remove the current process's mapping of shared FTE, which others
+//still map
+static void frame_unshare (struct frame_table_entry *fte){
+  struct thread *cur = thread_current ();
+  struct frame_sharer *sharer = NULL;
+  struct list_elem *e;
+
+  if (fte->thread == cur){
+    // promote another mapper
+    pagedir_clear_page (cur->pagedir, fte->upage);
+    sharer = list_entry (list_pop_front (&fte->sharers),
+                         struct frame_sharer, elem);
+    fte->thread = sharer->thread;
+    fte->upage = sharer->upage;
+    free (sharer);
+    return;
+  }
+
+  for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers);
+       e = list_next (e)){
+    sharer = list_entry (e, struct frame_sharer, elem);
+    if (sharer->thread == cur)
+      break;
+  }
+  ASSERT (e != list_end (&fte->sharers));
+  list_remove (e);
+  pagedir_clear_page (cur->pagedir, sharer->upage);
+  free (sharer);
+}
+
+//true if any mapper of FTE wrote to it
+bool frame_dirty (struct frame_table_entry *fte){
+  bool dirty = pagedir_is_dirty (fte->thread->pagedir, fte->upage);
+  struct list_elem *e;
+
+  for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers);
+       e = list_next (e)){
+    struct frame_sharer *sharer = list_entry (e, struct frame_sharer, elem);
+    dirty |= pagedir_is_dirty (sharer->thread->pagedir, sharer->upage);
+  }
+  return dirty;
+}
+
+//share resident page P of PARENT with the current thread, which is
+//being forked from it and owns the copy C.  Writable pages become
+//copy-on-write in both.  Caller holds lock_frame
+bool frame_fork (struct thread *parent, struct page *p, struct page *c){
+  struct frame_table_entry *fte = get_frame (p->kpage);
+  struct frame_sharer *sharer;
+
+  ASSERT (lock_held_by_current_thread (&lock_frame));
+  ASSERT (fte != NULL);
+
+  sharer = malloc (sizeof *sharer);
+  if (sharer == NULL || !install_page (c->upage, fte->kpage, false)){
+    free (sharer);
+    return false;
+  }
+  sharer->thread = thread_current ();
+  sharer->upage = c->upage;
+  list_push_back (&fte->sharers, &sharer->elem);
+
+  if (p->writable){
+    // the frame may already differ from the file, and once the
+    // parent's mapping is gone its dirty bit would be lost
+    if (pagedir_is_dirty (parent->pagedir, p->upage))
+      p->file_backed = c->file_backed = false;
+    pagedir_set_writable (parent->pagedir, p->upage, false);
+    p->cow = c->cow = true;
+  }
+  return true;
+}
+
+//handle a write fault on PAGE of the current thread.  A
+//copy-on-write page takes over its frame if no one else maps it any
+//more, otherwise it gets a copy of its own.  False if PAGE is simply
+//read-only
+bool frame_cow (struct page *page){
+  struct thread *cur = thread_current ();
+  struct frame_table_entry *fte;
+  bool pin = page->pin;
+
   lock_acquire(&lock_frame);
-  
+  // evicted since the fault; the retried access loads it again
+  if (page->kpage == NULL){
+    lock_release(&lock_frame);
+    return true;
+  }
+  if (!page->cow){
+    lock_release(&lock_frame);
+    return false;
+  }
+
+  fte = get_frame (page->kpage);
+  if (list_empty (&fte->sharers))
+    pagedir_set_writable (cur->pagedir, page->upage, true);
+  else{
+    // the pin keeps the shared frame resident while we allocate
+    page->pin = true;
+    uint8_t *kpage = frame_get (PAL_USER);
+    memcpy (kpage, page->kpage, PGSIZE);
+    frame_unshare (fte);
+    bool install_success = install_page (page->upage, kpage, true);
+    ASSERT(install_success);
+    frame_insert (page->upage, kpage, true);
+    page->kpage = kpage;
+    page->pin = pin;
+  }
+  page->cow = false;
+  lock_release(&lock_frame);
+  return true;
+}
+
+//true if any mapper of FTE accessed it, clearing the bits if CLEAR
+static bool frame_accessed (struct frame_table_entry *fte, bool clear){
+  bool accessed = pagedir_is_accessed (fte->thread->pagedir, fte->upage);
+  struct list_elem *e;
+
+  for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers);
+       e = list_next (e)){
+    struct frame_sharer *sharer = list_entry (e, struct frame_sharer, elem);
+    accessed |= pagedir_is_accessed (sharer->thread->pagedir, sharer->upage);
+  }
+
+  if (accessed && clear){
+    pagedir_set_accessed (fte->thread->pagedir, fte->upage, false);
+    for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers);
+         e = list_next (e)){
+      struct frame_sharer *sharer = list_entry (e, struct frame_sharer, elem);
+      pagedir_set_accessed (sharer->thread->pagedir, sharer->upage, false);
+    }
+  }
+  return accessed;
+}
+
+//true if FTE holds a loaded, unpinned page that may be evicted.  A
+//page still being read in has not set kpage yet, so it is skipped
+static bool frame_evictable (struct frame_table_entry *fte){
+  struct hash *page_hash = &(((fte->thread)->process_sema)->page_hash);
+  struct page *page = get_page (page_hash, fte->upage);
+
+  struct list_elem *e;
+
+  if (page == NULL || page->pin || page->kpage != fte->kpage)
+    return false;
+  for (e = list_begin (&fte->sharers); e != list_end (&fte->sharers);
+       e = list_next (e)){
+    struct frame_sharer *sharer = list_entry (e, struct frame_sharer, elem);
+    if (get_page (&sharer->thread->process_sema->page_hash, sharer->upage)->pin)
+      return false;
+  }
+  return page->type == PAGE_LOADED || page->type == PAGE_MMAP;
+}
+
+//enhanced clock: sweeping from where the last eviction stopped,
+//first look for a frame neither accessed nor dirty, then for one
+//not accessed, clearing accessed bits on the way, and repeat once
+//all have been cleared.  Accessed and dirty bits are those of the
+//owner's page directory.  Returns NULL if no frame can be evicted
+struct frame_table_entry *choose_frame_evict() {
+  struct frame_table_entry *fte;
+  size_t i, n = list_size (&FIFO_list);
+  int round;
+
+  ASSERT (lock_held_by_current_thread (&lock_frame));
+
+  for (round = 0; round < 4; round++){
+    bool clear = round % 2 == 1;
+
+    for (i = 0; i < n; i++){
+      if (clock_hand == list_end (&FIFO_list))
+        clock_hand = list_begin (&FIFO_list);
+      fte = list_entry (clock_hand, struct frame_table_entry, elem_list);
+      clock_hand = list_next (clock_hand);
+
+      if (!frame_evictable (fte))
+        continue;
+
+      if (frame_accessed (fte, clear))
+        continue;
+      if (clear || !frame_dirty (fte))
+        return fte;
+    }
+  }
+  return NULL;
+}
+
+//get a free page, evicting a frame if there is none.  Caller holds
+//lock_frame
+static uint8_t *frame_get (enum palloc_flags flags){
   uint8_t *kpage = palloc_get_page(flags);
   
   if (kpage == NULL) {
@@ -86,23 +389,44 @@ uint8_t *frame_allocate (void *upage, bool writable, enum palloc_flags flags){
     kpage = palloc_get_page(flags);
     ASSERT(kpage != NULL);
   }
-  
-  bool install_success = install_page(upage, kpage, writable);
-  ASSERT(install_success);
-  
+  // running low: let the cleaner free frames before faults have to
+  if ((flags & PAL_USER) && palloc_free_cnt (PAL_USER) < SWAP_LOW_WATER)
+    swap_wake_cleaner ();
+  return kpage;
+}
+
+//enter KPAGE, mapped at UPAGE of the current thread, in the frame
+//table.  Caller holds lock_frame
+static void frame_insert (void *upage, void *kpage, bool writable){
   struct frame_table_entry *fte;
   fte = (struct frame_table_entry *) malloc (sizeof(struct frame_table_entry));
   fte->upage = (void *) ((uintptr_t) upage & ~PGMASK);
   fte->kpage = (void *) ((uintptr_t) kpage & ~PGMASK);
   fte->writable = writable;
   fte->thread = thread_current();
+  fte->shared = false;
+  list_init (&fte->sharers);
   
   list_push_back (&FIFO_list, &fte->elem_list);
   struct hash_elem *old_hash = hash_replace (&frame_table, &fte->elem_hash);
   ASSERT(old_hash == NULL);
+}
+
+uint8_t *frame_allocate (void *upage, bool writable, enum palloc_flags flags){
+#ifdef DEBUG
+  printf("frame_allocate in upage %p %s\n",upage,thread_current()->name);
+#endif
+  lock_acquire(&lock_frame);
+  
+  uint8_t *kpage = frame_get (flags);
+  
+  bool install_success = install_page(upage, kpage, writable);
+  ASSERT(install_success);
+  
+  frame_insert (upage, kpage, writable);
 
 #ifdef DEBUG
-  printf("frame_allocate kpage %p\n",fte->kpage);
+  printf("frame_allocate kpage %p\n",kpage);
 #endif
   lock_release(&lock_frame);
 #ifdef DEBUG
@@ -123,22 +447,42 @@ void frame_free (void *kpage, bool locked){
   if (!locked)
     lock_acquire(&lock_frame);
 
-  palloc_free_page(kpage);
+  struct frame_table_entry *fte = get_frame(kpage);
+  ASSERT(fte != NULL)
+
+  // a shared frame stays until its last mapper lets go
+  if (!list_empty (&fte->sharers))
+    frame_unshare (fte);
+  else{
+    palloc_free_page(kpage);
+    frame_remove(kpage);
+  }
+
+  if (!locked)
+    lock_release(&lock_frame);
+#ifdef DEBUG
+  printf("frame_free out kpage %p %s\n",kpage,thread_current()->name);
+#endif
+}
+
+//drop KPAGE from the frame table and unmap it, but keep the page
+//itself allocated.  Caller holds lock_frame
+void frame_remove (void *kpage){
+  ASSERT (lock_held_by_current_thread (&lock_frame));
 
   struct frame_table_entry *fte = get_frame(kpage);
 
   ASSERT(fte != NULL)
 
+  if (clock_hand == &fte->elem_list)
+    clock_hand = list_next (clock_hand);
+  ASSERT(list_empty (&fte->sharers));
   list_remove (&fte->elem_list);
   hash_delete (&frame_table, &fte->elem_hash);
+  if (fte->shared)
+    hash_delete (&share_table, &fte->elem_share);
 
   pagedir_clear_page(fte->thread->pagedir, fte->upage);
 
   free(fte);
-
-  if (!locked)
-    lock_release(&lock_frame);
-#ifdef DEBUG
-  printf("frame_free out kpage %p %s\n",kpage,thread_current()->name);
-#endif
 }
@@ -2,6 +2,8 @@
 #define VM_FRAME_H
 
 #include "lib/kernel/hash.h"
+#include "devices/disk.h"
+#include "filesys/off_t.h"
 #include "threads/palloc.h"
 
 struct lock lock_frame;
@@ -13,11 +15,40 @@ struct frame_table_entry {
   struct thread *thread;
   struct list_elem elem_list;
   struct hash_elem elem_hash;
+
+  // read-only file pages are shared by every process that maps the
+  // same (sector, ofs, read_bytes); the rest of the page is zeroed,
+  // so segments reading different amounts differ.  THREAD and UPAGE
+  // above are one mapper, the others are in sharers
+  bool shared;
+  disk_sector_t sector;
+  off_t ofs;
+  size_t read_bytes;
+  struct list sharers;
+  struct hash_elem elem_share;
+};
+
+/* An additional mapping of a shared frame. */
+struct frame_sharer {
+  struct thread *thread;
+  void *upage;
+  struct list_elem elem;
 };
 
+struct page;
+struct thread;
+
 void frame_init (void);
 struct frame_table_entry *choose_frame_evict(void);
 uint8_t *frame_allocate (void *, bool, enum palloc_flags);
 void frame_free (void *, bool);
+void frame_remove (void *);
+bool frame_share (struct page *);
+void frame_share_add (void *, struct page *);
+void frame_unmap_sharers (struct frame_table_entry *, int);
+void frame_unmap (struct frame_table_entry *);
+bool frame_dirty (struct frame_table_entry *);
+bool frame_fork (struct thread *, struct page *, struct page *);
+bool frame_cow (struct page *);
 
 #endif
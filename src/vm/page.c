@@ -1,16 +1,26 @@
 #include "vm/page.h"
 #include <stdio.h>
 #include "lib/kernel/hash.h"
+#include "filesys/file.h"
+#include "filesys/inode.h"
 #include "threads/synch.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
 #include "threads/vaddr.h"
+#include "userprog/pagedir.h"
 #include "userprog/process.h"
 #include "vm/frame.h"
 #include "vm/swap.h"
+#include "vm/vma.h"
 
 bool lock_set;
 
+/* All-zero frame mapped read-only for PAGE_ZERO pages that are read
+   before they are written.  Allocated by page_zero_init() at boot.
+   Not in the frame table, so never evicted, and unmapped before
+   page directories are destroyed. */
+static uint8_t *zero_page;
+
 struct hash *get_current_hash();
 unsigned page_hash_func (const struct hash_elem *, void *);
 bool page_less_func (const struct hash_elem *, const struct hash_elem *, void * UNUSED);
@@ -19,6 +29,8 @@ bool page_load_file(struct page *);
 bool page_load_stack(struct page *);
 bool page_load_swap(struct page *);
 bool page_load_mmap(struct page *);
+bool page_load_zero(struct page *, bool);
+static bool page_load_around(struct page *);
 
 
 
@@ -45,14 +57,68 @@ struct page *get_page(struct hash *h, void *addr) {
                     elem_hash);
 }
 
-void page_set_pin (void *buffer, unsigned size, bool pin){
-  void *upage;
-  struct page *page;
-  int differ;
-  differ = thread_current()->esp - (buffer + size - 1);
-  for (upage = pg_round_down(buffer); upage < buffer+size; upage+=PGSIZE){
-    page = get_page (NULL, upage);
-    page->pin = pin;
+// page of the current process at ADDR, created from its region if
+// it was not touched before.  NULL if ADDR is not mapped
+struct page *page_lookup(void *addr){
+  struct page *page = get_page (NULL, addr);
+
+  return page != NULL ? page : vma_page (addr);
+}
+
+// load the pages of the user buffer BUFFER of SIZE bytes and pin
+// them, so that copying to or from it inside the file system, which
+// holds inode and cache locks, cannot fault.  WRITE makes the pages
+// privately writable first.  False if BUFFER is not accessible that
+// way; pages pinned so far stay pinned until page_unpin_buffer()
+bool page_pin_buffer (const void *buffer, unsigned size, bool write){
+  struct thread *t = thread_current ();
+  uint8_t *upage;
+
+  for (upage = pg_round_down (buffer);
+       upage < (const uint8_t *) buffer + size; upage += PGSIZE){
+    struct page *page;
+    bool present;
+
+    if (!is_user_vaddr (upage))
+      return false;
+    // same stack growth rule as the page fault handler
+    if (upage >= (uint8_t *) pg_round_down (t->esp)
+        && upage >= (uint8_t *) PHYS_BASE - STACK_MAX)
+      vma_grow_stack (upage);
+    page = page_lookup (upage);
+    if (page == NULL || (write && !page->writable))
+      return false;
+
+    // the cleaner checks pins under lock_frame, so once this is set
+    // a present page stays present
+    lock_acquire (&lock_frame);
+    page->pin = true;
+    present = pagedir_get_page (t->pagedir, upage) != NULL;
+    lock_release (&lock_frame);
+
+    if (!present && !page_load (upage, write))
+      return false;
+    // the zero frame and copy-on-write frames are mapped read-only
+    if (write && (page->cow || page->type == PAGE_ZERO)
+        && !page_write_fault (upage))
+      return false;
+  }
+  return true;
+}
+
+// undo page_pin_buffer()
+void page_unpin_buffer (const void *buffer, unsigned size){
+  uint8_t *upage;
+
+  for (upage = pg_round_down (buffer);
+       upage < (const uint8_t *) buffer + size; upage += PGSIZE){
+    struct page *page = get_page (NULL, upage);
+
+    if (page != NULL){
+      lock_acquire (&lock_frame);
+      page->pin = false;
+      lock_release (&lock_frame);
+    }
   }
 }
 
@@ -68,6 +134,11 @@ page_less_func (const struct hash_elem *a, const struct hash_elem *b, void *aux
        < hash_entry(b, struct page, elem_hash)->upage;
 }
 
+// allocate the shared zero frame; called once at boot
+void page_zero_init(void) {
+  zero_page = palloc_get_page (PAL_ZERO | PAL_ASSERT);
+}
+
 void page_init(struct hash *h) {
   hash_init(h, page_hash_func, page_less_func, NULL);
   if (!lock_set) {
@@ -81,6 +152,8 @@ hash_action_func *page_free (struct hash_elem *h, void *aux UNUSED){
     
     if (page->kpage != NULL)
       frame_free (page->kpage, true);
+    else if (page->type == PAGE_ZERO)
+      pagedir_clear_page (thread_current ()->pagedir, page->upage);
     
     if(page->type == PAGE_SWAP)
       swap_free (page->slot);
@@ -99,14 +172,28 @@ void page_destroy(struct hash *h) {
   //lock_release(&lock_frame);
 }
 
-void page_add_file(struct file *file, off_t ofs, uint8_t *upage, size_t page_read_bytes, size_t page_zero_bytes, bool writable) {
+// add PAGE to the current process's page table.  The page cleaner
+// looks up pages of other processes under lock_frame, so tables only
+// change under it
+static void page_insert(struct page *page){
+  lock_acquire(&lock_frame);
+  struct hash_elem *old_hash = hash_insert(current_page_hash(), &page->elem_hash);
+  ASSERT(old_hash == NULL);
+  lock_release(&lock_frame);
+}
+
+struct page *page_add_file(struct file *file, off_t ofs, uint8_t *upage, size_t page_read_bytes, size_t page_zero_bytes, bool writable) {
 #ifdef DEBUG
   printf("page add file in %p %s\n",upage,thread_current()->name);
 #endif
   struct page *page = malloc(sizeof(struct page));
+  if (page == NULL)
+    return NULL;
 
-  page->type = PAGE_FILE;
+  page->type = page_read_bytes == 0 ? PAGE_ZERO : PAGE_FILE;
   page->pin = false;
+  page->cow = false;
+  page->file_backed = true;
   page->file = file;
   page->ofs = ofs;
   page->upage = upage;
@@ -115,50 +202,46 @@ void page_add_file(struct file *file, off_t ofs, uint8_t *upage, size_t page_rea
   page->page_zero_bytes = page_zero_bytes;
   page->writable = writable;
 
-  struct hash_elem *old_hash = hash_insert(current_page_hash(), &page->elem_hash);
-  ASSERT(old_hash == NULL);
+  page_insert(page);
 #ifdef DEBUG
   printf("page add file out %p %s\n",upage,thread_current()->name);
 #endif
-
+  return page;
 }
 
 
 
-void page_add_stack(void *addr) {
-  if (get_page(NULL, pg_round_down(addr)) != NULL)
-    return;
-
+// stack page UPAGE, zeroed when first loaded
+struct page *page_add_stack(void *upage) {
 #ifdef DEBUG
-  printf("page add stack in %p %s\n",addr,thread_current()->name);
-#endif
-  void *upage;
-  for(upage=pg_round_down(addr);
-      get_page(NULL,upage)==NULL && upage<PHYS_BASE; upage+=PGSIZE){
-    struct page *page = malloc(sizeof(struct page));
-
-    page->type = PAGE_STACK;
-    page->pin = false;
-    page->upage = upage;
-    page->kpage = NULL;
-    page->writable = true;
-    struct hash_elem *old_hash = hash_insert(current_page_hash(), &page->elem_hash);
-    ASSERT(old_hash == NULL);
-  }
-#ifdef DEBUG
-  printf("page add stack out %p %s\n",addr,thread_current()->name);
+  printf("page add stack %p %s\n",upage,thread_current()->name);
 #endif
+  struct page *page = malloc(sizeof(struct page));
+  if (page == NULL)
+    return NULL;
+
+  page->type = PAGE_STACK;
+  page->pin = false;
+  page->cow = false;
+  page->file_backed = false;
+  page->upage = upage;
+  page->kpage = NULL;
+  page->writable = true;
+  page_insert(page);
+  return page;
 }
 
 
 
-bool page_add_mmap(struct mte *mte, off_t ofs, uint8_t *upage, size_t page_read_bytes, size_t page_zero_bytes, bool writable){
-  if (get_page(NULL, upage) != NULL)
-    return false;
+struct page *page_add_mmap(struct mte *mte, off_t ofs, uint8_t *upage, size_t page_read_bytes, size_t page_zero_bytes, bool writable){
   ASSERT(pg_ofs(upage) == 0)
   struct page *page = malloc(sizeof(struct page));
+  if (page == NULL)
+    return NULL;
   page->type = PAGE_MMAP;
   page->pin = false;
+  page->cow = false;
+  page->file_backed = false;
   page->mte = mte;
   page->ofs = ofs;
   page->upage = upage;
@@ -166,19 +249,23 @@ bool page_add_mmap(struct mte *mte, off_t ofs, uint8_t *upage, size_t page_read_
   page->page_read_bytes = page_read_bytes;
   page->page_zero_bytes = page_zero_bytes;
   page->writable = writable;
-  struct hash_elem *old_hash = hash_insert(current_page_hash(), &page->elem_hash);
-  ASSERT(old_hash == NULL);
-  return true;
+  page_insert(page);
+  return page;
 }
 
-void page_write_mmap(void *addr){
+// write mmapped page ADDR of thread T back to its file if T dirtied it
+void page_write_mmap(struct thread *t, void *addr){
 
-  struct page *page = get_page (NULL, addr);
+  struct page *page = get_page (&t->process_sema->page_hash, addr);
 
   ASSERT(page->kpage != NULL);
   
-  if (pagedir_is_dirty(thread_current()->pagedir, addr)){
-      int read_bytes = file_write_at (page->mte->file, page->kpage, page->page_read_bytes, page->ofs);
+  // written straight from the frame.  The dirty bit is cleared
+  // before writing, so a store made during the write sets it again
+  // and is written by the next pass instead of being lost
+  while (pagedir_is_dirty(t->pagedir, addr)){
+      pagedir_set_dirty (t->pagedir, addr, false);
+      int read_bytes = inode_write_page (file_get_inode (page->mte->file), page->kpage, page->page_read_bytes, page->ofs);
       ASSERT(read_bytes == (int) page->page_read_bytes);
   }
 }
@@ -189,7 +276,7 @@ void page_free_mmap(void *addr){
   ASSERT(page->type == PAGE_MMAP)
 
   if (page->kpage != NULL) {
-    page_write_mmap (addr);
+    page_write_mmap (thread_current (), addr);
 
     if (lock_held_by_current_thread(&lock_frame))
       frame_free(page->kpage, true);
@@ -197,7 +284,13 @@ void page_free_mmap(void *addr){
       frame_free(page->kpage, false);
   }
 
-  hash_delete (current_page_hash(), &page->elem_hash);
+  if (lock_held_by_current_thread(&lock_frame))
+    hash_delete (current_page_hash(), &page->elem_hash);
+  else{
+    lock_acquire(&lock_frame);
+    hash_delete (current_page_hash(), &page->elem_hash);
+    lock_release(&lock_frame);
+  }
   free (page);
 }
 
@@ -217,6 +310,8 @@ bool page_change_swap(struct hash *h, void *upage, int slot, bool writable, pid_
   page->kpage = NULL;
   page->writable = writable;
   page->slot = slot;
+  page->file_backed = false;
+  page->cow = false;
 
 #ifdef DEBUG
   printf("page add swap out %p %s\n",upage,thread_current()->name);
@@ -227,40 +322,190 @@ bool page_change_swap(struct hash *h, void *upage, int slot, bool writable, pid_
 
 
 
-bool page_load(void * addr) {
+// give the current thread, being forked from PARENT, a copy of
+// PARENT's pages.  Resident pages share their frame copy-on-write
+// and swapped-out ones their slot; mappings are not inherited.  EXE
+// is the child's own handle on the executable.  Caller holds
+// lock_frame and swap_lock
+bool page_fork(struct thread *parent, struct file *exe){
+  struct hash_iterator i;
+
+  ASSERT(lock_held_by_current_thread(&lock_frame));
+  ASSERT(lock_held_by_current_thread(&swap_lock));
+
+  hash_first (&i, &parent->process_sema->page_hash);
+  while (hash_next (&i)){
+    struct page *p = hash_entry (hash_cur (&i), struct page, elem_hash);
+    struct page *c;
+
+    if (p->type == PAGE_MMAP)
+      continue;
+    c = malloc (sizeof *c);
+    if (c == NULL)
+      return false;
+    *c = *p;
+    c->pin = false;
+    if (p->type == PAGE_FILE || p->file_backed)
+      c->file = exe;
+
+    if (p->type == PAGE_SWAP)
+      swap_dup (p->slot);
+    else if (p->kpage != NULL && !frame_fork (parent, p, c)){
+      free (c);
+      return false;
+    }
+    hash_insert (current_page_hash (), &c->elem_hash);
+  }
+  return true;
+}
+
+// handle a write fault at ADDR of the current process, which hit a
+// read-only mapping.  False unless that is the zero frame or a
+// copy-on-write page
+bool page_write_fault(void *addr){
   struct page *page = get_page (NULL, addr);
+
+  if (page == NULL)
+    return false;
+  if (page->type == PAGE_ZERO){
+    if (!page->writable)
+      return false;
+    pagedir_clear_page (thread_current ()->pagedir, page->upage);
+    return page_load_zero (page, true);
+  }
+  return frame_cow (page);
+}
+
+// type of file-backed PAGE once its frame is dropped
+enum page_type page_file_type(struct page *page){
+  return page->page_read_bytes == 0 ? PAGE_ZERO : PAGE_FILE;
+}
+
+// record where the contents of page ADDR of thread T will be found
+// once its frame, already unmapped from every mapper, is evicted.
+// DIRTY tells whether any mapper wrote to it.  Returns false if the contents
+// must be written to swap, which page_change_swap() then records;
+// mmapped pages go back to their file, and clean pages that still
+// match the executable are simply dropped
+bool page_evict(struct thread *t, void *addr, bool dirty){
+  struct page *page = get_page (&t->process_sema->page_hash, addr);
+
+  ASSERT (page != NULL && page->kpage != NULL);
+
+  if (page->type == PAGE_MMAP){
+    page_write_mmap (t, addr);
+    page->kpage = NULL;
+  }
+  else if (page->file_backed && !dirty){
+    page->type = page_file_type (page);
+    page->kpage = NULL;
+    page->cow = false;
+  }
+  else
+    return false;
+
+  pagedir_clear_page (t->pagedir, addr);
+  return true;
+}
+
+
+
+bool page_load(void * addr, bool write) {
+  // the evictor unmaps a frame before it updates the page under
+  // lock_frame; wait for it so the page is not seen half evicted
+  lock_acquire (&lock_frame);
+  lock_release (&lock_frame);
+
+  struct page *page = page_lookup (addr);
   if (page == NULL)
     return false;
   switch (page->type) {
     case PAGE_FILE:
-      return page_load_file(page);
+    case PAGE_MMAP:
+      return page_load_around(page);
+    case PAGE_ZERO:
+      return page_load_zero(page, write);
     case PAGE_STACK:
       return page_load_stack(page);
     case PAGE_SWAP:
       return page_load_swap(page);
-    case PAGE_MMAP:
-      return page_load_mmap(page);
     default:
       return false;
   }
 }
 
+// true if NEXT is a non-resident page read from the same file as
+// PAGE, which was of TYPE before it was loaded.  A PAGE_FILE page is
+// PAGE_LOADED by then, so its own type cannot be compared
+static bool same_source (enum page_type type, struct page *page,
+                         struct page *next){
+  if (next->type != type || next->kpage != NULL)
+    return false;
+  if (type == PAGE_MMAP)
+    return next->mte == page->mte;
+  return next->file == page->file;
+}
+
+// load file-backed PAGE, then the pages after it that come from the
+// same file, up to the process's fault window
+static bool page_load_around (struct page *page){
+  struct process_sema *ps = thread_current ()->process_sema;
+  enum page_type type = page->type;
+  bool pin = page->pin;
+  unsigned i;
+
+  // sequential access faults just past the previous window
+  if (page->upage == ps->fault_next){
+    if (ps->fault_window < FAULT_AROUND_MAX)
+      ps->fault_window *= 2;
+  }
+  else if (ps->fault_window > FAULT_AROUND_MIN)
+    ps->fault_window /= 2;
+
+  if (!(type == PAGE_MMAP ? page_load_mmap (page) : page_load_file (page)))
+    return false;
+
+  // keep the faulting page from being evicted to make room for the rest
+  page->pin = true;
+  for (i = 1; i < ps->fault_window; i++){
+    struct page *next;
+
+    // only use frames that are free anyway
+    if (palloc_free_cnt (PAL_USER) <= SWAP_HIGH_WATER)
+      break;
+    next = page_lookup (page->upage + i * PGSIZE);
+    if (next == NULL || !same_source (type, page, next))
+      break;
+    if (!(type == PAGE_MMAP ? page_load_mmap (next) : page_load_file (next)))
+      break;
+  }
+  page->pin = pin;
+  ps->fault_next = page->upage + i * PGSIZE;
+  return true;
+}
+
 
 
 bool page_load_file(struct page *page) {
 #ifdef DEBUG
   printf("page load file in %p %s\n",page->upage,thread_current()->name);
 #endif
-  
+  // read-only pages are shared with other processes running the file
+  if (!page->writable && frame_share (page))
+    return true;
+
   uint8_t *kpage = frame_allocate(page->upage, page->writable, PAL_USER);
-  page->kpage = kpage;
 
   /* Load this page. */
   if (file_read_at (page->file, kpage, page->page_read_bytes, page->ofs) != (int) page->page_read_bytes)
     ASSERT(0);
   memset (kpage + page->page_read_bytes, 0, page->page_zero_bytes);
 
+  // published only once filled, as in page_load_mmap()
+  page->kpage = kpage;
   page->type = PAGE_LOADED;
+  if (!page->writable)
+    frame_share_add (kpage, page);
 
 #ifdef DEBUG
   printf("page load file out %p %s\n",page->upage,thread_current()->name);
@@ -271,6 +516,18 @@ bool page_load_file(struct page *page) {
 
 
 
+// a read maps the shared zero frame; a write gets a private frame
+bool page_load_zero(struct page *page, bool write) {
+  if (!write || !page->writable)
+    return install_page (page->upage, zero_page, false);
+
+  page->kpage = frame_allocate(page->upage, true, PAL_USER | PAL_ZERO);
+  page->type = PAGE_LOADED;
+  return true;
+}
+
+
+
 bool page_load_stack(struct page *page) {
 #ifdef DEBUG
   printf("page load stack in %p %s\n",page->upage,thread_current()->name);
@@ -309,13 +566,17 @@ bool page_load_swap(struct page *page) {
 
 bool page_load_mmap(struct page *page) {
   uint8_t *kpage = frame_allocate(page->upage, page->writable, PAL_USER);
-  page->kpage = kpage;
   
-  if (file_read_at (page->mte->file, kpage, page->page_read_bytes, page->ofs)
+  // read into the frame without going through the buffer cache
+  if (inode_read_page (file_get_inode (page->mte->file), kpage,
+                       page->page_read_bytes, page->ofs)
       != (int) page->page_read_bytes)
     ASSERT(0);
 
   memset (kpage + page->page_read_bytes, 0, page->page_zero_bytes);
-  
+
+  // frame_evictable() skips the frame until kpage is set, so it
+  // cannot be evicted while the read above is still filling it
+  page->kpage = kpage;
   return true;
 }
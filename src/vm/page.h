@@ -5,11 +5,19 @@
 #include "userprog/process.h"
 #include "userprog/syscall.h"
 
+/* Fault-around: a PAGE_FILE or PAGE_MMAP fault also maps the
+   following pages of the same file, up to a window that doubles
+   while faults are sequential and halves when they are not. */
+#define FAULT_AROUND_MIN 1
+#define FAULT_AROUND_INIT 4
+#define FAULT_AROUND_MAX 16
+
 enum page_type {
   PAGE_FILE,
   PAGE_STACK,
   PAGE_SWAP,
   PAGE_MMAP,
+  PAGE_ZERO,      // all zeros, maps the shared zero frame until written
   PAGE_LOADED,
 };
 
@@ -20,6 +28,10 @@ struct page {
   uint8_t *kpage;
   bool writable;
   bool pin;
+  bool file_backed;   // contents can be read back from file, so a
+                      // clean eviction needs no swap slot
+  bool cow;           // writable, but mapped read-only and shared
+                      // with a forked process until written
 
   // Fields for file
   struct file *file;
@@ -34,22 +46,31 @@ struct page {
 
   // Fileds for mmap
   struct mte *mte;
+  struct list_elem elem_vma;   // vma->pages
 
   struct hash_elem elem_hash;
 };
 
-bool page_add_mmap(struct mte *, off_t, uint8_t *, size_t, size_t, bool);
-void page_write_mmap(void *);
+struct page *page_add_mmap(struct mte *, off_t, uint8_t *, size_t, size_t, bool);
+void page_write_mmap(struct thread *, void *);
+bool page_evict(struct thread *, void *, bool);
+bool page_fork(struct thread *, struct file *);
+bool page_write_fault(void *);
+enum page_type page_file_type(struct page *);
 void page_free_mmap(void *);
 
-void page_set_pin(void *, unsigned, bool);
+struct page *get_page(struct hash *, void *);
+struct page *page_lookup(void *);
+bool page_pin_buffer(const void *, unsigned, bool);
+void page_unpin_buffer(const void *, unsigned);
 
+void page_zero_init(void);
 void page_init(struct hash *);
 void page_destroy(struct hash *);
 
-void page_add_file(struct file *, off_t, uint8_t *, size_t, size_t, bool);
-void page_add_stack(void *);
+struct page *page_add_file(struct file *, off_t, uint8_t *, size_t, size_t, bool);
+struct page *page_add_stack(void *);
 bool page_change_swap(struct hash *, void *, int, bool, pid_t);
-bool page_load(void *);
+bool page_load(void *, bool);
 
 #endif
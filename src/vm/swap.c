@@ -6,29 +6,105 @@
 #include "threads/vaddr.h"
 #include "threads/palloc.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "userprog/pagedir.h"
 #include "vm/frame.h"
 #include "vm/page.h"
 
 
 
+/* Swap is divided into page-sized slots, numbered from 0. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Freed slots are pushed on a stack and handed out again first,
+   so allocation is O(1) while the stack lasts.  Slots that do not
+   fit are only marked free in swap_bitmap, which is searched from
+   where the last search stopped once the stack runs dry. */
+#define SWAP_STACK_SIZE 64
+
+/* Frames the page cleaner evicts per batch. */
+#define SWAP_BATCH 8
+
 struct disk *swap_disk;
-struct bitmap *swap_bitmap;
+struct bitmap *swap_bitmap;     // one bit per slot, true if in use
+static uint8_t *swap_refs;      // pages referring to each slot, which
+                                // processes share after fork
+static int swap_stack[SWAP_STACK_SIZE];
+static size_t swap_stack_cnt;
+static size_t swap_hint;
+
+// statistics
+static size_t swap_used_cnt, swap_peak_cnt;
+static long long swap_in_cnt, swap_out_cnt;
+
+// page cleaner
+static struct condition cleaner_cond;
+static long long swap_cleaned_cnt;
+
+static int swap_alloc (void);
+static size_t evict_frames (size_t, bool);
+static void swap_cleaner (void *);
 
 
 
 void swap_init(){
   swap_disk = disk_get (1,1);
-  swap_bitmap = bitmap_create (disk_size(swap_disk));
+  swap_bitmap = bitmap_create (disk_size(swap_disk) / SECTORS_PER_SLOT);
   bitmap_set_all (swap_bitmap, false);
+  swap_refs = calloc (bitmap_size (swap_bitmap), sizeof *swap_refs);
+  if (swap_refs == NULL)
+    PANIC ("cannot allocate swap reference counts");
   lock_init(&swap_lock);
+  cond_init(&cleaner_cond);
+  thread_create ("swap_cleaner", PRI_DEFAULT, swap_cleaner, NULL);
 }
 
-void swap_free (int slot){
+// take a free slot, or return -1 if swap is full
+static int swap_alloc (void){
   ASSERT(lock_held_by_current_thread(&swap_lock));
-  int i;
-  for(i=0; i<8; i++){
-    bitmap_flip (swap_bitmap, slot+i);
+  size_t slot;
+
+  if (swap_stack_cnt > 0)
+    slot = swap_stack[--swap_stack_cnt];
+  else{
+    slot = bitmap_scan (swap_bitmap, swap_hint, 1, false);
+    if (slot == BITMAP_ERROR)
+      slot = bitmap_scan (swap_bitmap, 0, 1, false);
+    if (slot == BITMAP_ERROR)
+      return -1;
+    swap_hint = slot + 1;
   }
+
+  ASSERT(!bitmap_test (swap_bitmap, slot));
+  bitmap_mark (swap_bitmap, slot);
+  swap_refs[slot] = 1;
+  if (++swap_used_cnt > swap_peak_cnt)
+    swap_peak_cnt = swap_used_cnt;
+  return slot;
+}
+
+// add a reference to SLOT, for a forked copy of a swapped-out page
+void swap_dup (int slot){
+  ASSERT(lock_held_by_current_thread(&swap_lock));
+  ASSERT(bitmap_test (swap_bitmap, slot));
+  ASSERT(swap_refs[slot] < UINT8_MAX);
+  swap_refs[slot]++;
+}
+
+// drop a reference to SLOT, freeing it with the last one
+void swap_free (int slot){
+  ASSERT(lock_held_by_current_thread(&swap_lock));
+  ASSERT(bitmap_test (swap_bitmap, slot));
+  ASSERT(swap_refs[slot] > 0);
+
+  if (--swap_refs[slot] > 0)
+    return;
+  bitmap_reset (swap_bitmap, slot);
+  swap_used_cnt--;
+  if (swap_stack_cnt < SWAP_STACK_SIZE)
+    swap_stack[swap_stack_cnt++] = slot;
 }
 
 void swap_in(void *kpage, int slot){
@@ -36,11 +112,10 @@ void swap_in(void *kpage, int slot){
   printf("swap in in %p, %d\n",kpage, slot);
 #endif
   lock_acquire(&swap_lock);
-  int i;
-  for (i=0; i<8; i++){
-    disk_read (swap_disk, slot+i, kpage+i*DISK_SECTOR_SIZE);
-    bitmap_flip (swap_bitmap, slot+i);
-  }
+  disk_read_multi (swap_disk, slot * SECTORS_PER_SLOT, kpage,
+                   SECTORS_PER_SLOT);
+  swap_free (slot);
+  swap_in_cnt++;
   lock_release(&swap_lock);
 #ifdef DEBUG
   printf("swap in out %p, %d\n",kpage,slot);
@@ -49,43 +124,120 @@ void swap_in(void *kpage, int slot){
 
 
 
-void swap_out() {
-#ifdef DEBUG
-  printf("swap out in\n");
-#endif
-  lock_acquire(&swap_lock);
-  
-  struct frame_table_entry *fte_evicted = choose_frame_evict();
-  ASSERT(fte_evicted != NULL)
+// evict up to CNT frames, submitting the swap writes together so
+// the disk queue can merge them.  Called with lock_frame held, which
+// is released before waiting for the writes if RELEASE.  Returns the
+// number of frames freed
+static size_t evict_frames (size_t cnt, bool release){
+  struct disk_request requests[SWAP_BATCH];
+  void *written[SWAP_BATCH];
+  size_t i, freed, writes = 0;
 
-  void *kpage = fte_evicted->kpage;
-  
-  int slot_start,i;
-  slot_start = bitmap_scan_and_flip(swap_bitmap, 0, 8, false);
+  ASSERT(lock_held_by_current_thread(&lock_frame));
+  ASSERT(cnt <= SWAP_BATCH);
+  lock_acquire(&swap_lock);
 
-  struct hash *page_hash = &(((fte_evicted->thread)->process_sema)->page_hash);
-  ASSERT(page_hash != NULL)
+  for (freed = 0; freed < cnt; freed++){
+    struct frame_table_entry *fte_evicted = choose_frame_evict();
+    if (fte_evicted == NULL)
+      break;
 
-  bool result = page_change_swap(page_hash,fte_evicted->upage, slot_start, fte_evicted->writable, fte_evicted->thread->tid);
+    void *kpage = fte_evicted->kpage;
+    struct hash *page_hash = &(((fte_evicted->thread)->process_sema)->page_hash);
 
-  pagedir_clear_page(fte_evicted->thread->pagedir, fte_evicted->upage);
+    // unmap first: a store after the dirty bits are read would be lost
+    frame_unmap (fte_evicted);
 
-  if (result == true){
-    for(i=0; i<8; i++){
-      disk_write(swap_disk, slot_start+i, kpage+i*DISK_SECTOR_SIZE);
+    // only pages that cannot be read back from a file use swap
+    if (page_evict (fte_evicted->thread, fte_evicted->upage,
+                    frame_dirty (fte_evicted))){
+      frame_unmap_sharers (fte_evicted, -1);
+      frame_free(kpage, true);
+      continue;
     }
-  }
-  else
-    page_write_mmap(fte_evicted->upage);
 
+    int slot = swap_alloc ();
+    if (slot < 0)
+      PANIC ("swap is full");
 #ifdef DEBUG
-  printf("swap out %p, %d\n",kpage, slot_start);
+    printf("swap out %p, %d\n",kpage, slot);
 #endif
 
-  frame_free(kpage, true);
+    // the page is unmapped now, so the owner faults into swap_in and
+    // waits on swap_lock until the write is done; the frame stays
+    // allocated until then
+    page_change_swap(page_hash,fte_evicted->upage, slot, fte_evicted->writable, fte_evicted->thread->tid);
+    frame_unmap_sharers (fte_evicted, slot);
+    frame_remove(kpage);
+
+    disk_request_init (&requests[writes], swap_disk, slot * SECTORS_PER_SLOT,
+                       kpage, SECTORS_PER_SLOT, true);
+    disk_submit (&requests[writes]);
+    written[writes++] = kpage;
+    swap_out_cnt++;
+  }
+
+  if (release)
+    lock_release(&lock_frame);
 
- lock_release(&swap_lock);
+  for (i = 0; i < writes; i++){
+    disk_wait (&requests[i]);
+    palloc_free_page (written[i]);
+  }
+  lock_release(&swap_lock);
+  return freed;
+}
+
+void swap_out() {
+#ifdef DEBUG
+  printf("swap out in\n");
+#endif
+  // may free nothing if the cleaner got there first
+  evict_frames (1, false);
 #ifdef DEBUG
  printf("swap out out\n");
 #endif
 }
+
+void swap_wake_cleaner (void){
+  ASSERT(lock_held_by_current_thread(&lock_frame));
+  cond_signal (&cleaner_cond, &lock_frame);
+}
+
+// page cleaner: sleeps until free user frames drop below
+// SWAP_LOW_WATER, then evicts in batches of up to SWAP_BATCH until
+// SWAP_HIGH_WATER frames are free again
+static void swap_cleaner (void *aux UNUSED){
+  size_t goal = SWAP_LOW_WATER;
+
+  for (;;){
+    size_t free_cnt, cnt, freed;
+
+    lock_acquire(&lock_frame);
+    while ((free_cnt = palloc_free_cnt (PAL_USER)) >= goal){
+      goal = SWAP_LOW_WATER;
+      cond_wait (&cleaner_cond, &lock_frame);
+    }
+    goal = SWAP_HIGH_WATER;
+
+    cnt = goal - free_cnt;
+    if (cnt > SWAP_BATCH)
+      cnt = SWAP_BATCH;
+    freed = evict_frames (cnt, true);
+    swap_cleaned_cnt += freed;
+    if (freed == 0){
+      // everything is pinned or in flight; retry on the next allocation
+      lock_acquire(&lock_frame);
+      cond_wait (&cleaner_cond, &lock_frame);
+      lock_release(&lock_frame);
+    }
+  }
+}
+
+void swap_print_stats (void){
+  printf ("Swap: %zu of %zu slots in use, peak %zu, %lld in, %lld out\n",
+          swap_used_cnt, bitmap_size (swap_bitmap), swap_peak_cnt,
+          swap_in_cnt, swap_out_cnt);
+  printf ("Swap: %lld frames evicted by the page cleaner\n",
+          swap_cleaned_cnt);
+}
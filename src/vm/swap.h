@@ -5,8 +5,17 @@
 
 struct lock swap_lock;
 
+/* The page cleaner is woken when fewer than SWAP_LOW_WATER user
+   frames are free and evicts until SWAP_HIGH_WATER are. */
+#define SWAP_LOW_WATER 8
+#define SWAP_HIGH_WATER 24
+
 void swap_init (void);
 void swap_in (void *, int);
 void swap_out(void);
+void swap_free (int);
+void swap_dup (int);
+void swap_wake_cleaner (void);
+void swap_print_stats (void);
 
 #endif
@@ -0,0 +1,230 @@
+#include "vm/vma.h"
+#include <round.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+
+static struct process_sema *current_ps (void);
+static size_t vma_search (struct process_sema *, const void *);
+static bool vma_insert (struct process_sema *, size_t, struct vma *);
+static void vma_remove (struct process_sema *, size_t);
+static bool vma_add (uint8_t *, uint8_t *, enum page_type, struct file *,
+                     struct mte *, off_t, size_t, bool);
+
+static struct process_sema *current_ps (void){
+  return thread_current ()->process_sema;
+}
+
+// index of the first region of PS ending above ADDR, or vma_cnt.
+// Regions are sorted and disjoint, so a binary search on END finds it
+static size_t vma_search (struct process_sema *ps, const void *addr){
+  size_t lo = 0, hi = ps->vma_cnt;
+
+  while (lo < hi){
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (ps->vmas[mid]->end <= (uint8_t *) addr)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// put VMA at index I of PS, doubling the array when it is full
+static bool vma_insert (struct process_sema *ps, size_t i, struct vma *vma){
+  if (ps->vma_cnt == ps->vma_cap){
+    size_t cap = ps->vma_cap == 0 ? 8 : 2 * ps->vma_cap;
+    struct vma **vmas = realloc (ps->vmas, cap * sizeof *vmas);
+
+    if (vmas == NULL)
+      return false;
+    ps->vmas = vmas;
+    ps->vma_cap = cap;
+  }
+  memmove (ps->vmas + i + 1, ps->vmas + i,
+           (ps->vma_cnt - i) * sizeof *ps->vmas);
+  ps->vmas[i] = vma;
+  ps->vma_cnt++;
+  return true;
+}
+
+// take the region at index I out of PS; the caller frees it
+static void vma_remove (struct process_sema *ps, size_t i){
+  ps->vma_cnt--;
+  memmove (ps->vmas + i, ps->vmas + i + 1,
+           (ps->vma_cnt - i) * sizeof *ps->vmas);
+}
+
+// add region [START, END) to the current process, keeping the array
+// sorted.  False if it overlaps an existing region
+static bool vma_add (uint8_t *start, uint8_t *end, enum page_type type,
+                     struct file *file, struct mte *mte, off_t ofs,
+                     size_t read_bytes, bool writable){
+  struct process_sema *ps = current_ps ();
+  struct vma *vma;
+  size_t i;
+
+  ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+
+  if (end <= start || end > (uint8_t *) PHYS_BASE)
+    return false;
+  i = vma_search (ps, start);
+  if (i < ps->vma_cnt && ps->vmas[i]->start < end)
+    return false;
+
+  vma = malloc (sizeof *vma);
+  if (vma == NULL)
+    return false;
+  vma->start = start;
+  vma->end = end;
+  vma->type = type;
+  vma->writable = writable;
+  vma->file = file;
+  vma->mte = mte;
+  vma->ofs = ofs;
+  vma->read_bytes = read_bytes;
+  list_init (&vma->pages);
+  if (!vma_insert (ps, i, vma)){
+    free (vma);
+    return false;
+  }
+  return true;
+}
+
+// executable segment at UPAGE: READ_BYTES from FILE at OFS, then
+// ZERO_BYTES of zeros
+bool vma_add_file (struct file *file, off_t ofs, uint8_t *upage,
+                   size_t read_bytes, size_t zero_bytes, bool writable){
+  return vma_add (upage, upage + read_bytes + zero_bytes, PAGE_FILE,
+                  file, NULL, ofs, read_bytes, writable);
+}
+
+// the pages MTE maps its file to
+bool vma_add_mmap (struct mte *mte){
+  uint8_t *start = mte->base;
+
+  return vma_add (start, start + ROUND_UP (mte->length, PGSIZE),
+                  PAGE_MMAP, NULL, mte, 0, mte->length, true);
+}
+
+// extend the stack region down to ADDR, creating it if the process
+// has none yet.  False if that would run into another region
+bool vma_grow_stack (void *addr){
+  struct process_sema *ps = current_ps ();
+  uint8_t *upage = pg_round_down (addr);
+  struct vma *stack;
+
+  if (vma_find (ps, upage) != NULL)
+    return true;
+
+  // the stack ends at PHYS_BASE, so it is always the last region
+  stack = ps->vma_cnt == 0 ? NULL : ps->vmas[ps->vma_cnt - 1];
+  if (stack == NULL || stack->type != PAGE_STACK)
+    return vma_add (upage, PHYS_BASE, PAGE_STACK, NULL, NULL, 0, 0, true);
+
+  if (ps->vma_cnt > 1 && ps->vmas[ps->vma_cnt - 2]->end > upage)
+    return false;
+  stack->start = upage;
+  return true;
+}
+
+// drop the region of MTE and every page created in it, writing
+// dirty ones back to the file
+void vma_unmap (struct mte *mte){
+  struct process_sema *ps = current_ps ();
+  size_t i = vma_search (ps, mte->base);
+  struct vma *vma = i < ps->vma_cnt ? ps->vmas[i] : NULL;
+
+  ASSERT (vma != NULL && vma->mte == mte);
+
+  while (!list_empty (&vma->pages)){
+    struct page *page = list_entry (list_pop_front (&vma->pages),
+                                    struct page, elem_vma);
+    page_free_mmap (page->upage);
+  }
+  vma_remove (ps, i);
+  free (vma);
+}
+
+// region of PS containing ADDR, or NULL
+struct vma *vma_find (struct process_sema *ps, const void *addr){
+  size_t i = vma_search (ps, addr);
+
+  if (i < ps->vma_cnt && ps->vmas[i]->start <= (uint8_t *) addr)
+    return ps->vmas[i];
+  return NULL;
+}
+
+// create the page at ADDR of the current process from the region
+// holding it.  NULL if ADDR is in no region.  The page must not
+// exist yet
+struct page *vma_page (void *addr){
+  struct vma *vma = vma_find (current_ps (), addr);
+  uint8_t *upage = pg_round_down (addr);
+  size_t ofs, read_bytes = 0;
+  struct page *page;
+
+  if (vma == NULL)
+    return NULL;
+
+  ofs = upage - vma->start;
+  if (ofs < vma->read_bytes)
+    read_bytes = vma->read_bytes - ofs < PGSIZE ? vma->read_bytes - ofs : PGSIZE;
+
+  switch (vma->type){
+    case PAGE_FILE:
+      return page_add_file (vma->file, vma->ofs + ofs, upage, read_bytes,
+                            PGSIZE - read_bytes, vma->writable);
+    case PAGE_MMAP:
+      page = page_add_mmap (vma->mte, vma->ofs + ofs, upage, read_bytes,
+                            PGSIZE - read_bytes, vma->writable);
+      if (page != NULL)
+        list_push_back (&vma->pages, &page->elem_vma);
+      return page;
+    default:
+      return page_add_stack (upage);
+  }
+}
+
+// copy the regions of PARENT to CHILD, which has none, except
+// mappings, which are not inherited.  EXE is the child's own handle
+// on the executable
+bool vma_fork (struct process_sema *parent, struct process_sema *child,
+               struct file *exe){
+  size_t i;
+
+  for (i = 0; i < parent->vma_cnt; i++){
+    struct vma *p = parent->vmas[i];
+    struct vma *c;
+
+    if (p->type == PAGE_MMAP)
+      continue;
+    c = malloc (sizeof *c);
+    if (c == NULL)
+      return false;
+    *c = *p;
+    if (c->type == PAGE_FILE)
+      c->file = exe;
+    list_init (&c->pages);
+    if (!vma_insert (child, child->vma_cnt, c)){
+      free (c);
+      return false;
+    }
+  }
+  return true;
+}
+
+// free every region of PS; their pages are freed by page_destroy()
+void vma_destroy (struct process_sema *ps){
+  size_t i;
+
+  for (i = 0; i < ps->vma_cnt; i++)
+    free (ps->vmas[i]);
+  free (ps->vmas);
+  ps->vmas = NULL;
+  ps->vma_cnt = ps->vma_cap = 0;
+}
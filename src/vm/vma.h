@@ -0,0 +1,41 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+
+#include <list.h>
+#include "filesys/off_t.h"
+#include "vm/page.h"
+
+struct process_sema;
+
+/* Lowest address the stack may grow down to is PHYS_BASE - STACK_MAX. */
+#define STACK_MAX 0x800000
+
+/* A region of a process's address space whose pages share one
+   backing and protection: an executable segment, a mapping, or the
+   stack.  The struct page of a page in it is only created when the
+   page is first faulted in. */
+struct vma {
+  uint8_t *start;          // first page
+  uint8_t *end;            // one past the last page
+  enum page_type type;     // PAGE_FILE, PAGE_MMAP or PAGE_STACK
+  bool writable;
+
+  // Fields for file and mmap
+  struct file *file;
+  struct mte *mte;
+  off_t ofs;               // file offset of START
+  size_t read_bytes;       // read from the file, the rest is zeroed
+
+  struct list pages;       // PAGE_MMAP pages created so far
+};
+
+bool vma_add_file (struct file *, off_t, uint8_t *, size_t, size_t, bool);
+bool vma_add_mmap (struct mte *);
+bool vma_grow_stack (void *);
+void vma_unmap (struct mte *);
+struct vma *vma_find (struct process_sema *, const void *);
+struct page *vma_page (void *);
+bool vma_fork (struct process_sema *, struct process_sema *, struct file *);
+void vma_destroy (struct process_sema *);
+
+#endif